@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+# Static cycle parity and timing checker for serial-ram-emu.pio, run at build time by pico/CMakeLists.txt.
+#
+#	check-pio-timing.py ../../../serial-ram-emu.pio        check, exit with status 1 on errors
+#	check-pio-timing.py -v ../../../serial-ram-emu.pio     also list the path lengths for each budget
+#
+# Checks, for each program:
+# - Cycle parity: an instruction commented `// odd` or `// even` must always execute on a cycle of that parity.
+#   Parity is followed along every control flow edge (both outcomes of every conditional jump), and is lost after
+#   blocking instructions (wait, blocking pull/push, irq wait). Each instruction after a blocking one starts a new
+#   group, and the annotated instructions reachable from it must agree on its parity.
+#   In a program with parity annotations, every `jmp pin`, `in pins` and `out pins` must be annotated.
+# - Timing budgets, by enumerating every path (with both outcomes of `jmp pin` and other unknown conditions,
+#   and X/Y tracked when they are set to known values; a path starts with the values of the closest preceding
+#   `set x` and `set y`). Budgets are declared in comments:
+#	// The code after this skip takes <expr> cycles before wrapping
+#	  from the next instruction to the wrap target
+#	// timing: <from> -> <to>[, <to>...] <op> <expr>[..<expr>] [with x = <expr>] [with y = <expr>]
+#	  from <from> to the first of the <to> instructions, where <from> and <to> are labels or `wrap`
+#	  (the wrap target), optionally +n instructions; <op> is =, <=, >= or `in` (with a range).
+#	  Paths that get to a <to> written as !<label> first are not timed. `with` gives X or Y a value at <from>,
+#	  e.g. for a loop on a register that is loaded from the TX FIFO.
+#   Expressions can use the .defines of the file and of the program.
+
+import argparse, re, sys
+
+BLOCKING_MSG = "blocking instruction"
+MAX_STEPS = 4096
+MAX_PATHS = 10000
+
+
+class CheckError(Exception): pass
+
+
+# Parsing
+# =======
+class Instruction:
+	def __init__(self, line_number, op, args, delay, annotation):
+		self.line_number = line_number
+		self.op = op
+		self.args = args # list of operand strings
+		self.delay = delay # expression string or None
+		self.annotation = annotation # "odd", "even" or None
+
+class Program:
+	def __init__(self, name, line_number):
+		self.name = name
+		self.line_number = line_number
+		self.instructions = []
+		self.labels = {}
+		self.defines = {}
+		self.wrap_target = None
+		self.wrap = None
+		self.budgets = [] # (line_number, from, [to], op, expressions, {register: expression})
+		self.pending_skip_budget = None # from "The code after this skip takes ..." until the next instruction
+
+def strip_block_comments(text):
+	# Keep the line structure for line numbers
+	return re.sub(r"/\*.*?\*/", lambda m: "\n"*m.group(0).count("\n"), text, flags=re.S)
+
+def parse(text):
+	defines = {}
+	programs = []
+	program = None
+	in_c_block = False
+	for line_number, line in enumerate(strip_block_comments(text).split("\n"), 1):
+		if in_c_block:
+			if line.strip().startswith("%}"): in_c_block = False
+			continue
+		if line.strip().startswith("%"):
+			in_c_block = not line.strip().startswith("%}") and "{" in line
+			continue
+
+		code, _, comment = line.partition("//")
+		code = code.strip()
+		comment = comment.strip()
+
+		if program is not None:
+			m = re.match(r"timing:\s*(\S+)\s*->\s*(.+?)\s*(<=|>=|=|in)\s*(.+?)((?:\s+with\s+[xy]\s*=\s*[^=]+?)*)$", comment)
+			if m:
+				tos = [t.strip() for t in m.group(2).split(",")]
+				xy = dict(re.findall(r"with\s+([xy])\s*=\s*(.+?)(?=\s+with\s|$)", m.group(5).strip()))
+				program.budgets.append((line_number, m.group(1), tos, m.group(3), m.group(4).split(".."), xy))
+			m = re.search(r"takes (.+) cycles before wrapping", comment)
+			if m and not code: program.pending_skip_budget = (line_number, m.group(1))
+
+		if not code: continue
+
+		if code.startswith("."):
+			words = code.split(None, 1)
+			directive, rest = words[0], (words[1] if len(words) > 1 else "")
+			if directive == ".program":
+				program = Program(rest.strip(), line_number)
+				programs.append(program)
+			elif directive == ".define":
+				parts = rest.split(None, 2) if rest.startswith("PUBLIC") else ["", *rest.split(None, 1)]
+				(program.defines if program is not None else defines)[parts[1]] = parts[2].strip()
+			elif directive == ".wrap_target":
+				program.wrap_target = len(program.instructions)
+			elif directive == ".wrap":
+				program.wrap = len(program.instructions) - 1
+			elif directive == ".word":
+				program.instructions.append(Instruction(line_number, ".word", [], None, None))
+			continue
+
+		m = re.match(r"(?:public\s+)?(\w+):\s*(.*)$", code)
+		if m:
+			program.labels[m.group(1)] = len(program.instructions)
+			code = m.group(2)
+			if not code: continue
+
+		if program is None: raise CheckError(f"{line_number}: instruction outside of a program")
+
+		delay = None
+		m = re.search(r"\[([^\]]*)\]\s*$", code)
+		if m:
+			delay = m.group(1)
+			code = code[:m.start()].strip()
+		code = re.sub(r"\bside\s+\S+", "", code).strip()
+		m = re.search(r"\[([^\]]*)\]\s*$", code) # delay before side set
+		if m:
+			delay = m.group(1)
+			code = code[:m.start()].strip()
+
+		op, _, args = code.partition(" ")
+		args = [a.strip() for a in args.split(",")] if args.strip() else []
+		annotation = None
+		m = re.match(r"(odd|even)\b", comment)
+		if m: annotation = m.group(1)
+
+		if program.pending_skip_budget is not None:
+			budget_line, expression = program.pending_skip_budget
+			program.budgets.append((budget_line, f"#{len(program.instructions)}", ["wrap"], "=", [expression], {}))
+			program.pending_skip_budget = None
+		program.instructions.append(Instruction(line_number, op, args, delay, annotation))
+	return defines, programs
+
+
+# Evaluation
+# ==========
+def evaluate(expression, defines, depth=0):
+	if depth > 20: raise CheckError(f"recursive define in '{expression}'")
+	def substitute(m):
+		name = m.group(0)
+		if name not in defines: raise CheckError(f"unknown symbol '{name}' in '{expression}'")
+		return f"({evaluate(defines[name], defines, depth + 1)})"
+	python = re.sub(r"\b[A-Za-z_]\w*\b", substitute, expression.replace("/", "//"))
+	python = re.sub(r"\(\((\d+)\)\)", r"(\1)", python)
+	if not re.fullmatch(r"[\d\sx+\-*/()<>&|~^]*", python): raise CheckError(f"can't evaluate '{expression}'")
+	return int(eval(python))
+
+def resolve(program, target, defines):
+	"""<label>[+n], wrap or #index -> instruction index"""
+	m = re.fullmatch(r"(#?\w+)(?:\+(\d+))?", target)
+	if not m: raise CheckError(f"bad instruction reference '{target}'")
+	name, offset = m.group(1), int(m.group(2) or 0)
+	if name.startswith("#"): index = int(name[1:])
+	elif name == "wrap": index = wrap_target(program)
+	elif name in program.labels: index = program.labels[name]
+	else: raise CheckError(f"unknown label '{name}'")
+	return index + offset
+
+
+# Control flow
+# ============
+def wrap_target(program): return program.wrap_target if program.wrap_target is not None else 0
+def wrap_source(program): return program.wrap if program.wrap is not None else len(program.instructions) - 1
+
+def cycles(program, instr, defines):
+	return 1 + (evaluate(instr.delay, defines) if instr.delay else 0)
+
+def is_blocking(instr):
+	if instr.op == "wait": return True
+	words = " ".join(instr.args).split()
+	if instr.op in ("pull", "push"): return "noblock" not in words
+	if instr.op == "irq": return "wait" in words
+	return False
+
+def next_index(program, index):
+	return wrap_target(program) if index == wrap_source(program) else index + 1
+
+def jump_target(program, instr):
+	target = instr.args[-1]
+	if target in program.labels: return program.labels[target]
+	return int(target, 0)
+
+def successors(program, index):
+	"""Possible next instructions, ignoring data: (index, condition) with condition None for unconditional"""
+	instr = program.instructions[index]
+	if instr.op == "jmp":
+		target = jump_target(program, instr)
+		if len(instr.args) == 1: return [target]
+		return [target, next_index(program, index)]
+	return [next_index(program, index)]
+
+
+# Parity
+# ======
+def check_parity(program, defines, errors):
+	annotated = [i for i, instr in enumerate(program.instructions) if instr.annotation]
+	if not annotated: return 0
+
+	for instr in program.instructions:
+		sampling = (instr.op == "jmp" and instr.args[:1] == ["pin"]) or (instr.op in ("in", "out") and instr.args[:1] == ["pins"])
+		if sampling and not instr.annotation:
+			errors.append(f"{instr.line_number}: {program.name}: `{instr.op} {', '.join(instr.args)}` has no parity annotation")
+
+	# Groups start at the program entry and after each blocking instruction
+	starts = [0] + [next_index(program, i) for i, instr in enumerate(program.instructions) if is_blocking(instr)]
+	for start in sorted(set(starts)):
+		offsets = {} # index -> set of cycle offsets mod 2 from start
+		queue = [(start, 0)]
+		while queue:
+			index, parity = queue.pop()
+			if parity in offsets.setdefault(index, set()): continue
+			offsets[index].add(parity)
+			instr = program.instructions[index]
+			if is_blocking(instr): continue
+			step = cycles(program, instr, defines)
+			for successor in successors(program, index): queue.append((successor, (parity + step) & 1))
+
+		start_parity = None
+		for index in sorted(offsets):
+			instr = program.instructions[index]
+			if not instr.annotation: continue
+			if len(offsets[index]) > 1:
+				errors.append(f"{instr.line_number}: {program.name}: annotated {instr.annotation}, but reached on both parities")
+				continue
+			parity = (instr.annotation == "odd") ^ next(iter(offsets[index]))
+			if start_parity is None: start_parity, first = parity, instr
+			elif parity != start_parity:
+				errors.append(f"{instr.line_number}: {program.name}: annotated {instr.annotation}, inconsistent with line {first.line_number} ({first.annotation})")
+	return len(annotated)
+
+
+# Paths
+# =====
+def initial_xy(program, defines, start):
+	"""Values of the closest `set x` and `set y` before start, for paths that start after them"""
+	xy = {"x": None, "y": None}
+	for instr in program.instructions[:start]:
+		if instr.op == "set" and instr.args[0] in xy: xy[instr.args[0]] = evaluate(instr.args[1], defines) & 31
+	return xy["x"], xy["y"]
+
+def path_lengths(program, defines, start, ends, stops=(), xy=None):
+	"""Lengths of all paths from start to the first of ends, with X and Y tracked when known; paths to stops are dropped"""
+	lengths = {}
+	x, y = initial_xy(program, defines, start)
+	if xy is not None: x, y = xy.get("x", x), xy.get("y", y)
+	stack = [(start, x, y, 0, 0)]
+	num_paths = 0
+	while stack:
+		index, x, y, length, steps = stack.pop()
+		if steps > 0 and index in stops: continue
+		if steps > 0 and index in ends:
+			lengths.setdefault(length, 0)
+			lengths[length] += 1
+			num_paths += 1
+			if num_paths > MAX_PATHS: raise CheckError("too many paths")
+			continue
+		if steps > MAX_STEPS: raise CheckError(f"path from #{start} doesn't end (loop with unknown count?)")
+		instr = program.instructions[index]
+		if is_blocking(instr): raise CheckError(f"line {instr.line_number}: {BLOCKING_MSG} on a timed path")
+		length += cycles(program, instr, defines)
+		steps += 1
+		fall = next_index(program, index)
+		op, args = instr.op, instr.args
+
+		if op == "set" and args[0] in ("x", "y"):
+			value = evaluate(args[1], defines) & 31
+			if args[0] == "x": x = value
+			else: y = value
+		elif op == "mov" and args[0] in ("x", "y"):
+			value = {"x": x, "y": y}.get(args[1]) if args[1] in ("x", "y") else None
+			if args[0] == "x": x = value
+			else: y = value
+		elif op == "out" and args[0] in ("x", "y"):
+			if args[0] == "x": x = None
+			else: y = None
+
+		if op != "jmp":
+			stack.append((fall, x, y, length, steps))
+			continue
+		target = jump_target(program, instr)
+		if len(args) == 1:
+			stack.append((target, x, y, length, steps))
+			continue
+		condition = args[0].replace(" ", "")
+		if condition in ("x--", "y--"):
+			value = x if condition == "x--" else y
+			if value is None: outcomes = [(True, None), (False, None)]
+			else: outcomes = [(value != 0, (value - 1) & 0xffffffff)]
+			for taken, new_value in outcomes:
+				nx, ny = (new_value, y) if condition == "x--" else (x, new_value)
+				stack.append((target if taken else fall, nx, ny, length, steps))
+		elif condition in ("!x", "!y") and (x if condition == "!x" else y) is not None:
+			taken = (x if condition == "!x" else y) == 0
+			stack.append((target if taken else fall, x, y, length, steps))
+		elif condition == "x!=y" and x is not None and y is not None:
+			stack.append((target if x != y else fall, x, y, length, steps))
+		else: # pin, !osre, or unknown data
+			stack.append((target, x, y, length, steps))
+			stack.append((fall, x, y, length, steps))
+	return lengths
+
+def check_budgets(program, defines, errors, verbose):
+	for line_number, start_ref, end_refs, op, expressions, xy in program.budgets:
+		where = f"{line_number}: {program.name}"
+		try:
+			start = resolve(program, start_ref, defines)
+			ends = {resolve(program, e, defines) for e in end_refs if not e.startswith("!")}
+			stops = {resolve(program, e[1:], defines) for e in end_refs if e.startswith("!")}
+			bounds = [evaluate(e, defines) for e in expressions]
+			lengths = path_lengths(program, defines, start, ends, stops, {r: evaluate(e, defines) & 0xffffffff for r, e in xy.items()})
+		except CheckError as e:
+			errors.append(f"{where}: {e}")
+			continue
+		if not lengths:
+			errors.append(f"{where}: no path from {start_ref} to {', '.join(end_refs)}")
+			continue
+
+		low, high = (bounds[0], bounds[-1]) if op in ("=", "in") else (bounds[0], None) if op == ">=" else (None, bounds[0])
+		if op == "=" and len(bounds) != 1: errors.append(f"{where}: use `in` for a range")
+		bad = [n for n in lengths if (low is not None and n < low) or (high is not None and n > high)]
+		description = ", ".join(f"{n} ({lengths[n]} path{'s' if lengths[n] > 1 else ''})" for n in sorted(lengths))
+		if bad:
+			expected = f"{low}" if low == high else f"{low if low is not None else ''}..{high if high is not None else ''}"
+			errors.append(f"{where}: {start_ref} -> {', '.join(end_refs)} takes {description} cycles, budget {expected}")
+		elif verbose:
+			print(f"{program.name}: {start_ref} -> {', '.join(end_refs)}: {description} cycles")
+	return len(program.budgets)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Check cycle parity annotations and timing budgets in a .pio file")
+	parser.add_argument("pio_file")
+	parser.add_argument("-v", "--verbose", action="store_true", help="list the path lengths for each budget")
+	args = parser.parse_args()
+
+	try:
+		global_defines, programs = parse(open(args.pio_file).read())
+	except CheckError as e:
+		sys.exit(f"{args.pio_file}:{e}")
+
+	errors = []
+	num_annotations = num_budgets = 0
+	for program in programs:
+		defines = {**global_defines, **program.defines}
+		try:
+			num_annotations += check_parity(program, defines, errors)
+		except CheckError as e:
+			errors.append(f"{program.line_number}: {program.name}: {e}")
+		num_budgets += check_budgets(program, defines, errors, args.verbose)
+
+	for error in errors: print(f"{args.pio_file}:{error}", file=sys.stderr)
+	print(f"{args.pio_file}: {len(programs)} programs, {num_annotations} parity annotations, {num_budgets} timing budgets, {len(errors)} errors")
+	sys.exit(1 if errors else 0)
+
+if __name__ == "__main__":
+	main()
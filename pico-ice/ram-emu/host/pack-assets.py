@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+# Packer for the asset archive that ram_emu_load_asset() in ram-emu.c decompresses into emu_ram.
+#
+# Each file becomes an asset named after the file (without extension, at most 15 characters),
+# stored uncompressed, RLE or LZ4 (block format) compressed, whichever is smallest unless --method is given.
+# Link the archive into flash with RAM_EMU_ASSETS in pico/CMakeLists.txt.
+#
+#	pack-assets.py -o assets.bin level1.bin tiles.bin         build the archive
+#	pack-assets.py -o assets.bin --vh assets.vh *.bin         also write Verilog localparams with the asset indices
+#	pack-assets.py --list assets.bin                          list the contents of an archive
+#
+# Archive format (little endian):
+#	header:    magic "RAEA", u32 number of assets
+#	directory: per asset: char name[16] (NUL terminated), u32 offset (from start of archive), u32 packed size,
+#	           u32 size (bytes, after decompression), u32 method (0 = stored, 1 = RLE, 2 = LZ4)
+#	data:      packed data, each asset 4 byte aligned
+#
+# RLE: control byte c, c < 128: c+1 literal bytes follow, c >= 128: the next byte repeated c-126 times (2..129).
+
+import argparse, os, re, struct, sys
+
+MAGIC = b"RAEA"
+STORED, RLE, LZ4 = range(3)
+METHOD_NAMES = ["stored", "rle", "lz4"]
+NAME_BYTES = 16
+ENTRY = struct.Struct("<16sIIII")
+EMU_RAM_BYTES = 2*65536
+
+
+# Compression
+# ===========
+def rle_compress(data):
+	out = bytearray()
+	literals = bytearray()
+	def flush():
+		while literals:
+			chunk = literals[:128]
+			out.append(len(chunk) - 1)
+			out.extend(chunk)
+			del literals[:128]
+	i = 0
+	while i < len(data):
+		run = 1
+		while i + run < len(data) and run < 129 and data[i + run] == data[i]: run += 1
+		if run >= 2:
+			flush()
+			out += bytes([run + 126, data[i]])
+		else:
+			literals.append(data[i])
+		i += run
+	flush()
+	return bytes(out)
+
+def rle_decompress(data):
+	out = bytearray()
+	i = 0
+	while i < len(data):
+		c = data[i]
+		if c < 128:
+			out += data[i + 1:i + 2 + c]
+			i += 2 + c
+		else:
+			out += bytes([data[i + 1]])*(c - 126)
+			i += 2
+	return bytes(out)
+
+# Greedy LZ4 block compressor, following the end of block rules:
+# the last 5 bytes are literals, and the last match starts at least 12 bytes before the end.
+def lz4_compress(data):
+	MIN_MATCH, LAST_LITERALS, MF_LIMIT = 4, 5, 12
+	out = bytearray()
+	table = {}
+	def length_bytes(n):
+		while n >= 255:
+			out.append(255)
+			n -= 255
+		out.append(n)
+	def sequence(literals, offset=0, match_len=0):
+		ml = match_len - MIN_MATCH if match_len else 0
+		out.append((min(len(literals), 15) << 4) | min(ml, 15))
+		if len(literals) >= 15: length_bytes(len(literals) - 15)
+		out.extend(literals)
+		if match_len:
+			out.extend(struct.pack("<H", offset))
+			if ml >= 15: length_bytes(ml - 15)
+
+	anchor = i = 0
+	match_limit = len(data) - LAST_LITERALS
+	while i < len(data) - MF_LIMIT:
+		key = data[i:i + MIN_MATCH]
+		candidate = table.get(key)
+		table[key] = i
+		if candidate is None or i - candidate > 0xffff:
+			i += 1
+			continue
+		n = MIN_MATCH
+		while i + n < match_limit and data[candidate + n] == data[i + n]: n += 1
+		sequence(data[anchor:i], i - candidate, n)
+		i += n
+		anchor = i
+	sequence(data[anchor:])
+	return bytes(out)
+
+def lz4_decompress(data):
+	out = bytearray()
+	i = 0
+	def length(n):
+		nonlocal i
+		if n == 15:
+			while True:
+				b = data[i]
+				i += 1
+				n += b
+				if b != 255: break
+		return n
+	while i < len(data):
+		token = data[i]
+		i += 1
+		n = length(token >> 4)
+		out += data[i:i + n]
+		i += n
+		if i >= len(data): break
+		offset = data[i] | (data[i + 1] << 8)
+		i += 2
+		n = length(token & 15) + 4
+		for _ in range(n): out.append(out[-offset])
+	return bytes(out)
+
+COMPRESS = [lambda d: d, rle_compress, lz4_compress]
+DECOMPRESS = [lambda d: d, rle_decompress, lz4_decompress]
+
+
+# Archive
+# =======
+def asset_name(path):
+	name = os.path.splitext(os.path.basename(path))[0]
+	if len(name.encode()) >= NAME_BYTES: sys.exit(f"{path}: asset name '{name}' is longer than {NAME_BYTES - 1} characters")
+	return name
+
+def pack(paths, method=None):
+	"""Returns (archive, [(name, size, packed size, method)])"""
+	assets = []
+	for path in paths:
+		data = open(path, "rb").read()
+		if len(data) > EMU_RAM_BYTES: sys.exit(f"{path}: larger than emu_ram ({len(data)} bytes)")
+		methods = [method] if method is not None else range(len(COMPRESS))
+		packed, m = min(((COMPRESS[m](data), m) for m in methods), key=lambda pm: len(pm[0]))
+		assert DECOMPRESS[m](packed) == data, f"{path}: {METHOD_NAMES[m]} round trip failed"
+		assets.append((asset_name(path), data, packed, m))
+	names = [a[0] for a in assets]
+	if len(set(names)) != len(names): sys.exit("asset names must be unique")
+
+	directory = bytearray(MAGIC + struct.pack("<I", len(assets)))
+	blob = bytearray()
+	offset = len(directory) + ENTRY.size*len(assets)
+	for name, data, packed, m in assets:
+		directory += ENTRY.pack(name.encode(), offset + len(blob), len(packed), len(data), m)
+		blob += packed
+		blob += bytes(-len(blob) % 4)
+	return bytes(directory + blob), [(name, len(data), len(packed), m) for name, data, packed, m in assets]
+
+def unpack(archive):
+	"""Returns [(name, data, packed size, method)]"""
+	if archive[:4] != MAGIC: sys.exit("not an asset archive")
+	(count,) = struct.unpack_from("<I", archive, 4)
+	assets = []
+	for index in range(count):
+		name, offset, packed_size, size, m = ENTRY.unpack_from(archive, 8 + ENTRY.size*index)
+		data = DECOMPRESS[m](archive[offset:offset + packed_size])
+		assert len(data) == size
+		assets.append((name.rstrip(b"\0").decode(), data, packed_size, m))
+	return assets
+
+def print_table(rows):
+	for index, (name, size, packed_size, m) in enumerate(rows):
+		print(f"{index:3d} {name:15s} {METHOD_NAMES[m]:6s} {size:6d} -> {packed_size:6d} bytes")
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Build an asset archive for ram_emu_load_asset")
+	parser.add_argument("files", nargs="*", help="asset files (raw bytes, loaded into emu_ram as is)")
+	parser.add_argument("-o", "--output", help="archive to write")
+	parser.add_argument("--method", choices=METHOD_NAMES, help="compression method for all assets (default: smallest)")
+	parser.add_argument("--vh", help="also write the asset indices as Verilog localparams to this file")
+	parser.add_argument("--list", metavar="ARCHIVE", help="list (and check) the contents of an archive instead")
+	args = parser.parse_args()
+
+	if args.list:
+		assets = unpack(open(args.list, "rb").read())
+		print_table([(name, len(data), packed_size, m) for name, data, packed_size, m in assets])
+		return
+	if not args.output or not args.files: parser.error("need -o and at least one file")
+
+	archive, rows = pack(args.files, None if args.method is None else METHOD_NAMES.index(args.method))
+	with open(args.output, "wb") as f: f.write(archive)
+	print_table(rows)
+	print(f"{len(archive)} bytes")
+
+	if args.vh:
+		with open(args.vh, "w") as f:
+			f.write("// Generated by pack-assets.py\n")
+			for index, (name, *_) in enumerate(rows):
+				f.write(f"localparam ASSET_{re.sub('[^A-Za-z0-9_]', '_', name).upper()} = {index};\n")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# Test driver for the USB stream bridge in ram-emu-main.c (USB_STREAM).
+#
+# Sends random data to the host -> FPGA ring, reads back what the user design writes to the FPGA -> host ring,
+# and reports the sustained rate. The user design is expected to loop the data back unchanged.
+#
+#	stream-test.py --model               run against a model of the board (bridge + loopback user design)
+#	stream-test.py --port /dev/ttyACM1   run against the board (second CDC interface, needs pyserial)
+
+import argparse, os, sys, time
+
+# Must match ram-emu-main.c
+STREAM_IN_ADDR    = 0xc000
+STREAM_OUT_ADDR   = 0xd000
+STREAM_RING_WORDS = 0x1000
+STREAM_CTRL_ADDR  = 0xfff0
+IN_HEAD, IN_TAIL, OUT_HEAD, OUT_TAIL = range(4)
+
+
+class BoardModel:
+	"""Model of the board: the bridge from stream_task() plus a user design that loops the in ring back to the out ring.
+	Word level, with a byte stream interface like a serial port."""
+
+	def __init__(self, cdc_bufsize=512, fpga_words_per_step=64):
+		self.emu_ram = [0]*65536
+		self.rx = bytearray() # host -> board CDC FIFO
+		self.tx = bytearray() # board -> host CDC FIFO
+		self.cdc_bufsize = cdc_bufsize
+		self.fpga_words_per_step = fpga_words_per_step
+
+	def write(self, data):
+		n = min(len(data), self.cdc_bufsize - len(self.rx))
+		self.rx += data[:n]
+		self.step()
+		return n
+
+	def read(self, n):
+		self.step()
+		data = bytes(self.tx[:n])
+		del self.tx[:n]
+		return data
+
+	def step(self):
+		self.stream_task()
+		self.fpga_step()
+		self.stream_task()
+
+	def stream_task(self):
+		ram, ctrl, mask = self.emu_ram, STREAM_CTRL_ADDR, STREAM_RING_WORDS - 1
+
+		head = ram[ctrl + IN_HEAD]
+		index = head & mask
+		words = min(STREAM_RING_WORDS - ((head - ram[ctrl + IN_TAIL]) & 0xffff), STREAM_RING_WORDS - index, len(self.rx) >> 1)
+		for i in range(words):
+			ram[STREAM_IN_ADDR + index + i] = self.rx[2*i] | (self.rx[2*i + 1] << 8)
+		del self.rx[:2*words]
+		ram[ctrl + IN_HEAD] = (head + words) & 0xffff
+
+		tail = ram[ctrl + OUT_TAIL]
+		index = tail & mask
+		words = min((ram[ctrl + OUT_HEAD] - tail) & 0xffff, STREAM_RING_WORDS - index, (self.cdc_bufsize - len(self.tx)) >> 1)
+		for i in range(words):
+			w = ram[STREAM_OUT_ADDR + index + i]
+			self.tx += bytes((w & 0xff, w >> 8))
+		ram[ctrl + OUT_TAIL] = (tail + words) & 0xffff
+
+	def fpga_step(self):
+		# What the user design does with read and write messages: copy words from the in ring to the out ring
+		ram, ctrl, mask = self.emu_ram, STREAM_CTRL_ADDR, STREAM_RING_WORDS - 1
+		for i in range(self.fpga_words_per_step):
+			in_tail, out_head = ram[ctrl + IN_TAIL], ram[ctrl + OUT_HEAD]
+			if in_tail == ram[ctrl + IN_HEAD] or ((out_head - ram[ctrl + OUT_TAIL]) & 0xffff) == STREAM_RING_WORDS: break
+			ram[STREAM_OUT_ADDR + (out_head & mask)] = ram[STREAM_IN_ADDR + (in_tail & mask)]
+			ram[ctrl + OUT_HEAD] = (out_head + 1) & 0xffff
+			ram[ctrl + IN_TAIL] = (in_tail + 1) & 0xffff
+
+
+class SerialPort:
+	def __init__(self, port):
+		import serial
+		self.port = serial.Serial(port, timeout=0, write_timeout=0)
+
+	def write(self, data):
+		try: return self.port.write(data) or 0
+		except Exception: return 0 # write timeout: nothing sent
+
+	def read(self, n):
+		return self.port.read(n)
+
+
+def run(dev, num_bytes, chunk, timeout):
+	data = os.urandom(num_bytes)
+	sent, received = 0, bytearray()
+	start = last_progress = time.monotonic()
+	while len(received) < num_bytes:
+		if sent < num_bytes: sent += dev.write(data[sent:sent + chunk])
+		r = dev.read(chunk)
+		if r: received += r; last_progress = time.monotonic()
+		if time.monotonic() - last_progress > timeout:
+			print("timeout: sent %d bytes, received %d" % (sent, len(received)))
+			return False
+	dt = time.monotonic() - start
+
+	if received != data:
+		first = next(i for i in range(num_bytes) if received[i] != data[i])
+		print("mismatch at byte %d" % first)
+		return False
+	print("%d bytes in %.3f s: %.3f MB/s" % (num_bytes, dt, num_bytes/dt/1e6))
+	return True
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Test driver for the USB stream bridge")
+	group = parser.add_mutually_exclusive_group(required=True)
+	group.add_argument("--model", action="store_true", help="run against a model of the board")
+	group.add_argument("--port", help="serial port of the stream CDC interface")
+	parser.add_argument("--bytes", type=int, default=1<<20, help="number of bytes to send (even)")
+	parser.add_argument("--chunk", type=int, default=4096)
+	parser.add_argument("--timeout", type=float, default=2.0, help="seconds without progress before giving up")
+	args = parser.parse_args()
+
+	dev = BoardModel() if args.model else SerialPort(args.port)
+	ok = run(dev, args.bytes & ~1, args.chunk, args.timeout)
+	sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+	main()
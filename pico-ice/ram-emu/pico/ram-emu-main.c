@@ -4,6 +4,7 @@
 #include "hardware/uart.h"
 #include "hardware/clocks.h"
 #include "hardware/pwm.h"
+#include "pico/multicore.h"
 #include "ice_usb.h"
 #include "ice_fpga.h"
 #include "ice_led.h"
@@ -16,6 +17,53 @@
 
 //#define HALF_FREQ
 
+// Flags for ram_emu_init_flags, see ram-emu.h
+#define RAM_EMU_FLAGS 0
+//#define RAM_EMU_FLAGS RAM_EMU_FLAG_TX_LOW_LATENCY
+//#define RAM_EMU_FLAGS RAM_EMU_FLAG_DOORBELL // handled on core1, see doorbell handlers below
+//#define RAM_EMU_FLAGS (RAM_EMU_FLAG_SINGLE_PIO | RAM_EMU_FLAG_FIXED_LATENCY) // leaves room for CALIBRATE_LATENCY to check it
+//#define RAM_EMU_FLAGS (RAM_EMU_FLAG_BURST_ADDR | RAM_EMU_FLAG_CONTINUE_READS) // sequential bursts with one read address message
+//#define RAM_EMU_FLAGS (RAM_EMU_FLAG_BURST_ADDR | RAM_EMU_FLAG_BACK_TO_BACK) // RX messages without idle cycles in between
+#define FIXED_LATENCY 32 // FPGA cycles, with RAM_EMU_FLAG_FIXED_LATENCY
+
+// Measure the read latency after releasing reset; the user design must send CALIBRATION_SAMPLES single word reads first thing.
+// The result is written to emu_ram[CALIBRATION_REPORT_ADDR] (max) and emu_ram[CALIBRATION_REPORT_ADDR + 1] (min).
+//#define CALIBRATE_LATENCY
+#define CALIBRATION_SAMPLES 16
+#define CALIBRATION_REPORT_ADDR 0xfffe
+
+// Measure the read latency without and with memory traffic from both cores, to compare memory layouts
+// (RAM_EMU_BANKED_LAYOUT in CMakeLists.txt). The user design must keep sending single word reads, as for CALIBRATE_LATENCY.
+// Uses core1, so it can't be combined with RAM_EMU_FLAG_DOORBELL.
+//#define CONTENTION_BENCHMARK
+#define BENCHMARK_SAMPLES 4096
+
+// Train the RX sampling phase after releasing reset; the user design must send the training pattern first thing (see ram-emu.c)
+//#define TRAIN_RX_PHASE
+#define TRAINING_WORDS_PER_PHASE 256
+
+// Stream data between the host and the user design through two rings in emu_ram, over the second USB CDC interface.
+// Ring pointers are free running 16 bit word counters at STREAM_CTRL_ADDR: in_head, in_tail, out_head, out_tail.
+// The host -> FPGA ring (in) is written by the RP2040, the FPGA -> host ring (out) by the user design. See docs/pio-ram-emulator.md.
+// USB_STREAM is set with the CMake option of the same name, since it also adds the second CDC interface in tusb_config.h and usb_descriptors.c.
+#define STREAM_CDC 1
+#define STREAM_IN_ADDR    0xc000
+#define STREAM_OUT_ADDR   0xd000
+#define STREAM_RING_WORDS 0x1000 // power of 2
+#define STREAM_CTRL_ADDR  0xfff0
+
+// Generate the FPGA clock with fpga_frame_clock instead of the PWM, with a frame sync pulse on FRAME_SYNC_PIN,
+// and run per-frame jobs during vertical blanking. The default timing is 640x480 VGA at 2 FPGA cycles per pixel (without HALF_FREQ):
+// 800x525 pixels per frame, with the sync pulse at the start of the 45 blanking lines.
+// emu_ram[FRAME_CTRL_ADDR] gets the frame number at each sync pulse; with RAM_EMU_ALT_LAYOUT, the user design can write 1 to
+// emu_ram[FRAME_CTRL_ADDR + 1] to swap emu_ram and emu_ram_alt between the read and write paths at the next blanking interval.
+// With USB_STREAM, the rings are only serviced during blanking.
+//#define FRAME_CLOCK
+#define FRAME_SYNC_PIN 15 // any free GPIO connected to the FPGA
+#define FRAME_FPGA_CYCLES (2*800*525)
+#define FRAME_VBLANK_FPGA_CYCLES (2*800*45)
+#define FRAME_CTRL_ADDR 0xffe0
+
 
 #define RESET_PIN 14
 
@@ -35,6 +83,108 @@ enum { RX_CFG_BITS_PER_MSG = 14, MSG_INDEX_BITS = 10, MAX_TX_BITS = 24, MAX_MESS
 
 
 
+#ifdef USB_STREAM
+enum { STREAM_IN_HEAD, STREAM_IN_TAIL, STREAM_OUT_HEAD, STREAM_OUT_TAIL };
+
+static uint32_t stream_bytes_in = 0, stream_bytes_out = 0;
+
+// Move as much data as possible between the USB CDC FIFOs and the rings, in contiguous chunks.
+// Only whole 16 bit words are moved, an odd byte stays in the CDC FIFO until its partner arrives.
+static void stream_task() {
+	volatile uint16_t *ctrl = emu_ram + STREAM_CTRL_ADDR;
+	const int mask = STREAM_RING_WORDS - 1;
+
+	// Host -> FPGA
+	uint16_t head = ctrl[STREAM_IN_HEAD];
+	int free_words = STREAM_RING_WORDS - (uint16_t)(head - ctrl[STREAM_IN_TAIL]);
+	int index = head & mask;
+	int words = MIN(free_words, STREAM_RING_WORDS - index);
+	words = MIN(words, tud_cdc_n_available(STREAM_CDC) >> 1);
+	if (words > 0) {
+		words = tud_cdc_n_read(STREAM_CDC, emu_ram + STREAM_IN_ADDR + index, words << 1) >> 1;
+		__compiler_memory_barrier();
+		ctrl[STREAM_IN_HEAD] = head + words; // publish after the data
+		stream_bytes_in += words << 1;
+	}
+
+	// FPGA -> host
+	uint16_t tail = ctrl[STREAM_OUT_TAIL];
+	int used_words = (uint16_t)(ctrl[STREAM_OUT_HEAD] - tail);
+	index = tail & mask;
+	words = MIN(used_words, STREAM_RING_WORDS - index);
+	words = MIN(words, tud_cdc_n_write_available(STREAM_CDC) >> 1);
+	if (words > 0) {
+		words = tud_cdc_n_write(STREAM_CDC, emu_ram + STREAM_OUT_ADDR + index, words << 1) >> 1;
+		tud_cdc_n_write_flush(STREAM_CDC);
+		__compiler_memory_barrier();
+		ctrl[STREAM_OUT_TAIL] = tail + words; // release after the data has been copied
+		stream_bytes_out += words << 1;
+	}
+}
+#endif
+
+// Doorbell handlers
+// =================
+enum { DOORBELL_PING = 0, DOORBELL_MUL32 = 1, DOORBELL_CHECKSUM = 2, DOORBELL_RING_WINDOWS = 3, DOORBELL_AFFINE_FETCH = 4, DOORBELL_LOAD_ASSET = 5 };
+
+// Does nothing, to measure the round trip
+static void doorbell_ping(volatile uint16_t *mailbox) {}
+
+// mailbox[1..2] * mailbox[3..4] -> mailbox[5..8], little endian 16 bit words
+static void doorbell_mul32(volatile uint16_t *mailbox) {
+	uint32_t a = mailbox[1] | (mailbox[2] << 16);
+	uint32_t b = mailbox[3] | (mailbox[4] << 16);
+	uint64_t p = (uint64_t)a * b;
+	for (int i = 0; i < 4; i++) mailbox[5 + i] = p >> (16*i);
+}
+
+#ifdef FRAME_CLOCK
+// Frame jobs
+// ==========
+enum { FRAME_JOB_COUNTER = 0, FRAME_JOB_FLIP = 1 };
+enum { FRAME_CTRL_COUNT, FRAME_CTRL_FLIP_REQUEST };
+
+static void frame_job_counter(uint32_t frame) {
+	emu_ram[FRAME_CTRL_ADDR + FRAME_CTRL_COUNT] = frame;
+}
+
+#ifdef RAM_EMU_ALT_LAYOUT
+// Display (read) one buffer while the user design renders (writes) into the other, swap them when asked to
+static void frame_job_flip(uint32_t frame) {
+	volatile uint16_t *request = emu_ram + FRAME_CTRL_ADDR + FRAME_CTRL_FLIP_REQUEST;
+	if (*request != 1) return;
+	bool alt_displayed = ram_emu_read_base == emu_ram_alt;
+	if (ram_emu_set_base(alt_displayed ? emu_ram : emu_ram_alt, alt_displayed ? emu_ram_alt : emu_ram)) *request = 0;
+}
+#endif
+#endif
+
+#ifdef CONTENTION_BENCHMARK
+// Contention benchmark
+// ====================
+enum { TRAFFIC_WORDS = 256 };
+static uint32_t traffic_buffer[2][TRAFFIC_WORDS]; // in RAM, like other CPU data
+static int benchmark_latency_min[2], benchmark_latency_max[2]; // idle, loaded
+
+static void memory_traffic(volatile uint32_t *buffer) {
+	for (int i = 0; i < TRAFFIC_WORDS; i++) buffer[i] += buffer[(i + 1) & (TRAFFIC_WORDS - 1)];
+}
+static void core0_traffic() { memory_traffic(traffic_buffer[0]); }
+static void core1_traffic() { while (true) memory_traffic(traffic_buffer[1]); }
+
+static void run_contention_benchmark() {
+	ram_emu_calibrate_latency(BENCHMARK_SAMPLES, 100000, -1);
+	benchmark_latency_min[0] = ram_emu_read_latency_min;
+	benchmark_latency_max[0] = ram_emu_read_latency_max;
+
+	multicore_launch_core1(core1_traffic);
+	ram_emu_calibrate_latency_loaded(BENCHMARK_SAMPLES, 100000, -1, core0_traffic);
+	multicore_reset_core1();
+	benchmark_latency_min[1] = ram_emu_read_latency_min;
+	benchmark_latency_max[1] = ram_emu_read_latency_max;
+}
+#endif
+
 static void init() {
 	// Initialize PLL, USB, ...
 	// ========================
@@ -57,6 +207,15 @@ static void init() {
 
 	// Set up FPGA clock -- start before RAM emulator
 	// ==============================================
+#ifdef FRAME_CLOCK
+	// Clock is held low until ram_emu_start_frame_clock
+	bool frame_clock_ok = ram_emu_init_frame_clock(FRAME_SYNC_PIN, FRAME_FPGA_CYCLES, FRAME_VBLANK_FPGA_CYCLES);
+	ram_emu_set_frame_job(FRAME_JOB_COUNTER, frame_job_counter);
+#ifdef RAM_EMU_ALT_LAYOUT
+	emu_ram[FRAME_CTRL_ADDR + FRAME_CTRL_FLIP_REQUEST] = 0;
+	ram_emu_set_frame_job(FRAME_JOB_FLIP, frame_job_flip);
+#endif
+#else
 	gpio_set_function(ICE_FPGA_CLOCK_PIN, GPIO_FUNC_PWM);
 	uint fpga_clock_slice_num = pwm_gpio_to_slice_num(ICE_FPGA_CLOCK_PIN);
 
@@ -64,17 +223,35 @@ static void init() {
 	pwm_set_wrap(fpga_clock_slice_num, 1);
 	pwm_set_chan_level(fpga_clock_slice_num, ICE_FPGA_CLOCK_PIN & 1, 1);
 	// The clock doesn't start until the pwm is enabled
+#endif
 
 	// Start the FPGA
 	// ==============
 	//clock_gpio_init(ICE_FPGA_CLOCK_PIN, CLOCKS_CLK_GPOUT0_CTRL_AUXSRC_VALUE_CLK_SYS, 2);
 	ice_fpga_start();
+#ifdef FRAME_CLOCK
+	ram_emu_start_frame_clock(); // starts the FPGA clock (reset is still high)
+#else
 	// Enable the PWM, starts the FPGA clock (reset is still high)
 	pwm_set_enabled(fpga_clock_slice_num, true);
+#endif
 
 	// Set up the RAM emulator
 	// =======================
-	bool ok = ram_emu_init(RX_PIN_BASE, TX_PIN_BASE, false);
+	bool ok = ram_emu_init_flags(RX_PIN_BASE, TX_PIN_BASE, false, RAM_EMU_FLAGS);
+#ifdef FRAME_CLOCK
+	ok = ok && frame_clock_ok;
+#endif
+
+	if (RAM_EMU_FLAGS & RAM_EMU_FLAG_DOORBELL) {
+		ram_emu_set_doorbell_handler(DOORBELL_PING, doorbell_ping);
+		ram_emu_set_doorbell_handler(DOORBELL_MUL32, doorbell_mul32);
+		ram_emu_set_doorbell_handler(DOORBELL_CHECKSUM, ram_emu_doorbell_checksum);
+		ram_emu_set_doorbell_handler(DOORBELL_RING_WINDOWS, ram_emu_doorbell_set_ring_windows);
+		ram_emu_set_doorbell_handler(DOORBELL_AFFINE_FETCH, ram_emu_doorbell_affine_fetch);
+		ram_emu_set_doorbell_handler(DOORBELL_LOAD_ASSET, ram_emu_doorbell_load_asset);
+		multicore_launch_core1(ram_emu_doorbell_core1_main);
+	}
 
 	// Check that it worked
 	// --------------------
@@ -82,14 +259,36 @@ static void init() {
 		while (true) {
 			tud_task();
 			printf("PIO init failed!\r\n");
+			if (ram_emu_init_error != NULL) printf("%s\r\n", ram_emu_init_error);
 		}
 	}
 
+	if (RAM_EMU_FLAGS & RAM_EMU_FLAG_FIXED_LATENCY) ram_emu_set_fixed_latency(FIXED_LATENCY);
+
+#ifdef TRAIN_RX_PHASE
+	// Release reset and train RX phase before starting the DMA
+	// ========================================================
+	gpio_put(RESET_PIN, false);
+	ram_emu_train_rx_phase(TRAINING_WORDS_PER_PHASE, 100000);
+
+	ram_emu_configure_dma(true);
+#else
 	ram_emu_configure_dma(true);
 
 	// Release reset
 	// =============
 	gpio_put(RESET_PIN, false);
+#endif
+
+#ifdef CALIBRATE_LATENCY
+	// Measure read latency
+	// ====================
+	ram_emu_calibrate_latency(CALIBRATION_SAMPLES, 100000, CALIBRATION_REPORT_ADDR);
+#endif
+
+#ifdef CONTENTION_BENCHMARK
+	run_contention_benchmark();
+#endif
 }
 
 int main(void) {
@@ -97,7 +296,11 @@ int main(void) {
 	// Initialization
 	// ==============
 
-	memset(emu_ram, 0, sizeof(emu_ram));
+	// Initial contents from RAM_EMU_IMAGE if set in CMakeLists.txt, zeros otherwise
+	ram_emu_load_image();
+#ifdef USB_STREAM
+	for (int i = 0; i < 4; i++) emu_ram[STREAM_CTRL_ADDR + i] = 0;
+#endif
 
 //	for (int i = 0; i < emu_ram_elements; i++) emu_ram[i] = i;
 /*
@@ -143,14 +346,63 @@ int main(void) {
 	// =========
 
 	uint64_t last_time = 0;
+#ifdef USB_STREAM
+	uint64_t last_report_time = 0;
+#endif
 	while (true) {
 		tud_task();
+#ifdef USB_STREAM
+#ifdef FRAME_CLOCK
+		if (ram_emu_vblank_us_left() > 0) stream_task(); // keep bulk traffic out of the scanout
+#else
+		stream_task();
+#endif
+#endif
 
 		uint64_t time = time_us_64();
 		bool step = (last_time & ~((1 << 16) - 1)) != (time & ~((1 << 16) - 1));
 
 		if (step) {
 			printf("hello\r\n");
+#ifdef TRAIN_RX_PHASE
+			printf("RX phase: %d\r\n", ram_emu_rx_phase);
+#endif
+#ifdef CALIBRATE_LATENCY
+			printf("read latency: %d <= latency <= %d\r\n", ram_emu_read_latency_min, ram_emu_read_latency_max);
+#endif
+#ifdef CONTENTION_BENCHMARK
+#ifdef RAM_EMU_BANKED_LAYOUT
+			const char *layout = "banked";
+#else
+			const char *layout = "striped";
+#endif
+			printf("read latency, %s layout: idle %d..%d, loaded %d..%d FPGA cycles\r\n", layout,
+				benchmark_latency_min[0], benchmark_latency_max[0], benchmark_latency_min[1], benchmark_latency_max[1]);
+#endif
+			if (RAM_EMU_FLAGS & RAM_EMU_FLAG_DOORBELL) {
+				printf("doorbell: dispatch <= %d cycles, done <= %d cycles\r\n", ram_emu_doorbell_dispatch_cycles_max, ram_emu_doorbell_done_cycles_max);
+
+				// Affine fetch rates since the last report: overall, and while a span was being sent
+				static uint32_t last_affine_pixels, last_affine_busy_us, last_affine_time;
+				uint32_t pixels = ram_emu_affine_pixels - last_affine_pixels;
+				uint32_t busy_us = ram_emu_affine_busy_us - last_affine_busy_us;
+				uint32_t affine_dt = (uint32_t)time - last_affine_time;
+				if (pixels) printf("affine fetch: %u pixels/s, %u pixels/s while busy\r\n", (uint32_t)(pixels * 1000000ull / affine_dt), (uint32_t)(pixels * 1000000ull / MAX(busy_us, 1)));
+				last_affine_pixels += pixels;
+				last_affine_busy_us += busy_us;
+				last_affine_time = time;
+			}
+			if (RAM_EMU_FLAGS & RAM_EMU_FLAG_FIXED_LATENCY) printf("fixed latency: %d cycles, %u missed\r\n", ram_emu_fixed_latency, ram_emu_fixed_latency_misses);
+#ifdef FRAME_CLOCK
+			printf("frames: %u, jobs <= %d us, %u overruns\r\n", ram_emu_frame_count, ram_emu_frame_jobs_max_us, ram_emu_frame_jobs_overruns);
+#endif
+#ifdef USB_STREAM
+			// Sustained rates since the last report, in kB/s
+			uint32_t dt = time - last_report_time;
+			printf("stream: in %u kB/s, out %u kB/s\r\n", (uint32_t)(stream_bytes_in * 1000ull / dt), (uint32_t)(stream_bytes_out * 1000ull / dt));
+			stream_bytes_in = stream_bytes_out = 0;
+			last_report_time = time;
+#endif
 		}
 
 		last_time = time;
@@ -44,7 +44,12 @@
 #define CFG_TUD_MAX_SPEED           OPT_MODE_FULL_SPEED
 
 // Device classes
+// The second CDC interface carries the RAM emulator stream (USB_STREAM in CMakeLists.txt)
+#ifdef USB_STREAM
+#define CFG_TUD_CDC                 2
+#else
 #define CFG_TUD_CDC                 1
+#endif
 #define CFG_TUD_MSC                 1
 #define CFG_TUD_DFU                 1
 #define CFG_TUD_DFU_ALT             2
@@ -27,6 +27,9 @@
 
 enum {
     ITF_NUM_CDC0, ITF_NUM_CDC0_DATA,
+#ifdef USB_STREAM
+    ITF_NUM_CDC1, ITF_NUM_CDC1_DATA,
+#endif
     ITF_NUM_MSC0,
     ITF_NUM_DFU,
     ITF_NUM_TOTAL
@@ -35,6 +38,9 @@ enum {
 uint8_t const tud_desc_configuration[CONFIG_TOTAL_LEN] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 500/*mA*/),
     TUD_CDC_DESCRIPTOR(ITF_NUM_CDC0, STRID_CDC+0, EPIN+1, 8, EPOUT+2, EPIN+2, 64),
+#ifdef USB_STREAM
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC1, STRID_CDC+1, EPIN+4, 8, EPOUT+5, EPIN+5, 64),
+#endif
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC0, STRID_MSC+0,            EPOUT+3, EPIN+3, 64),
     TUD_DFU_DESCRIPTOR(ITF_NUM_DFU, CFG_TUD_DFU_ALT, STRID_DFU, DFU_ATTR_CAN_DOWNLOAD, 1000, CFG_TUD_DFU_XFER_BUFSIZE),
 };
@@ -46,6 +52,9 @@ char const *tud_string_desc[STRID_NUM_TOTAL] = {
     [STRID_SERIAL_NUMBER]   = usb_serial_number,
     [STRID_VENDOR]          = USB_VENDOR,
     [STRID_CDC+0]           = "RP2040 logs",
+#ifdef USB_STREAM
+    [STRID_CDC+1]           = "RAM emulator stream",
+#endif
     [STRID_MSC+0]           = "iCE40 MSC (Flash)",
     [STRID_DFU+0]           = "iCE40 DFU (CRAM)",
     [STRID_DFU+1]           = "iCE40 DFU (Flash)",
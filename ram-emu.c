@@ -1,18 +1,60 @@
 #include "hardware/structs/bus_ctrl.h"
+#include "hardware/clocks.h"
 #include "hardware/dma.h"
+#include "hardware/interp.h"
+#include "hardware/irq.h"
+#include "hardware/structs/systick.h"
+#include "pico/time.h"
+#include <string.h>
 
 #include "ram-emu.h"
 
 #include "build/serial-ram-emu.pio.h"
 
 uint16_t __attribute__((section(".spi_ram.emu_ram"))) emu_ram[65536];
+#ifdef RAM_EMU_ALT_LAYOUT
+uint16_t __attribute__((section(".spi_ram_alt.emu_ram_alt"))) emu_ram_alt[65536];
+#endif
+
+uint16_t *ram_emu_read_base = emu_ram, *ram_emu_write_base = emu_ram;
 
 PSM tx_rdata_psm;
 PSM rx_wdata_psm, rx_waddr_psm, rx_wcount_psm;
 PSM               rx_raddr_psm, rx_rcount_psm;
+PSM read_queue_psm, write_queue_psm;
+PSM rx_bwrite_psm;
+PSM rx_doorbell_psm;
+PSM rx_continue_psm;
 
 int rx_wdata_channel, rx_waddr_channel, rx_wcount_channel;
 int tx_rdata_channel, rx_raddr_channel, rx_rcount_channel;
+int read_queue_channel, tx_rdata_ctrl_channel;
+int write_queue_channel, rx_wdata_ctrl_channel;
+int rx_bwaddr_channel, rx_bwdata_channel;
+int write_ack_channel;
+int continue_read_channel, continue_trigger_channel;
+
+// Queued reads: {count, address} of the last received read address, sampled into the read queue
+static uint32_t __attribute__((aligned(8))) read_queue_entry[2] = {1, 0};
+// Queued writes: {address, count} of the last received write address, sampled into the write queue
+static uint32_t __attribute__((aligned(8))) write_queue_entry[2] = {0, 1};
+// Continue reads: sink for the popped continue read messages, and the channel mask written to MULTI_CHAN_TRIGGER
+static uint32_t continue_read_sink, continue_read_trigger;
+
+uint ram_emu_flags;
+volatile uint32_t ram_emu_write_ack_word = 0xffffffff;
+static int ram_emu_rx_pin_base, ram_emu_tx_pin_base;
+
+int ram_emu_read_latency_min = -1, ram_emu_read_latency_max = -1;
+
+int ram_emu_fixed_latency = RAM_EMU_FIXED_LATENCY_DEFAULT;
+int ram_emu_rx_max_data_cycles = SBIO2_RX_LOOP_COUNT;
+volatile uint32_t ram_emu_fixed_latency_misses = 0;
+
+// DMA address wrap for the TX rdata and RX wdata channels, log2 of the window size in bytes (0 = no wrapping)
+static int read_ring_bits = 0, write_ring_bits = 0;
+
+int ram_emu_rx_phase = RAM_EMU_RX_PHASE_DEFAULT;
 
 
 bool add_psm(PSM *psm, PIO pio, const pio_program_t *program) {
@@ -44,16 +86,42 @@ void init_dma() {
 	// ---------------------
 	rx_wdata_channel = dma_claim_unused_channel(true);
 	rx_waddr_channel = dma_claim_unused_channel(true);
-	rx_wcount_channel = dma_claim_unused_channel(true);
+	if (!(ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR)) rx_wcount_channel = dma_claim_unused_channel(true);
 
 	tx_rdata_channel = dma_claim_unused_channel(true);
 	rx_raddr_channel = dma_claim_unused_channel(true);
-	rx_rcount_channel = dma_claim_unused_channel(true);
+	if (!(ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR)) rx_rcount_channel = dma_claim_unused_channel(true);
+
+	if (ram_emu_flags & (RAM_EMU_FLAG_QUEUED_READS | RAM_EMU_FLAG_BURST_ADDR)) read_queue_channel = dma_claim_unused_channel(true);
+	if (ram_emu_flags & RAM_EMU_FLAG_QUEUED_READS) tx_rdata_ctrl_channel = dma_claim_unused_channel(true);
+	if (ram_emu_flags & RAM_EMU_FLAG_QUEUED_WRITES) {
+		write_queue_channel = dma_claim_unused_channel(true);
+		rx_wdata_ctrl_channel = dma_claim_unused_channel(true);
+	}
+	if (ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES) {
+		rx_bwaddr_channel = dma_claim_unused_channel(true);
+		rx_bwdata_channel = dma_claim_unused_channel(true);
+	}
+	if (ram_emu_flags & RAM_EMU_FLAG_WRITE_ACKS) write_ack_channel = dma_claim_unused_channel(true);
+	if (ram_emu_flags & RAM_EMU_FLAG_CONTINUE_READS) {
+		continue_read_channel = dma_claim_unused_channel(true);
+		continue_trigger_channel = dma_claim_unused_channel(true);
+	}
 }
 
 void ram_emu_configure_dma(bool enable) {
 	// Writing
 	// =======
+	// With RAM_EMU_FLAG_QUEUED_WRITES, each received write address is paired with the current write count and pushed into the write queue,
+	// and the RX wdata channel chains to the RX wdata ctrl channel, which loads the next pair from the queue into it (same as for queued reads).
+	bool queued_writes = ram_emu_flags & RAM_EMU_FLAG_QUEUED_WRITES;
+	// With RAM_EMU_FLAG_BURST_ADDR, the address SMs push {address, count} for each address message
+	bool burst_addr = ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR;
+	// With RAM_EMU_FLAG_BURST_ADDR, there are no count SMs (counts come only from burst address messages)
+	bool count_messages = !burst_addr;
+	// With RAM_EMU_FLAG_WRITE_ACKS, the RX wdata channel chains to the write ack channel when a transaction finishes,
+	// which chains on to the RX wdata ctrl channel with RAM_EMU_FLAG_QUEUED_WRITES
+	bool write_acks = ram_emu_flags & RAM_EMU_FLAG_WRITE_ACKS;
 
 	// RX wdata channel
 	// ----------------
@@ -65,7 +133,11 @@ void ram_emu_configure_dma(bool enable) {
 	channel_config_set_read_increment(&rx_wdata_cfg, false);
 	channel_config_set_write_increment(&rx_wdata_cfg, true);
 	if (enable) channel_config_set_dreq(&rx_wdata_cfg, pio_get_dreq(rx_wdata_psm.pio, rx_wdata_psm.sm, false)); // dreq from RX FIFO
-	channel_config_set_transfer_data_size(&rx_wdata_cfg, DMA_SIZE_16);
+	// With RAM_EMU_FLAG_PACKED_WRITES, each RX FIFO entry holds two words
+	channel_config_set_transfer_data_size(&rx_wdata_cfg, (ram_emu_flags & (RAM_EMU_FLAG_LONG_WORDS | RAM_EMU_FLAG_PACKED_WRITES)) ? DMA_SIZE_32 : DMA_SIZE_16);
+	if (write_acks) channel_config_set_chain_to(&rx_wdata_cfg, write_ack_channel);
+	else if (queued_writes) channel_config_set_chain_to(&rx_wdata_cfg, rx_wdata_ctrl_channel);
+	if (write_ring_bits) channel_config_set_ring(&rx_wdata_cfg, true, write_ring_bits); // see ram_emu_set_ring_windows
 
 	//dma_channel_configure(rx_wdata_channel, &rx_wdata_cfg, rx_wdata_channel_dest, rx_wdata_channel_src, sizeof(emu_ram)/2, true); // Start the channel, very big transfer count
 	dma_channel_configure(rx_wdata_channel, &rx_wdata_cfg, rx_wdata_channel_dest, rx_wdata_channel_src, 1, false); // trans_count = 1, don't start
@@ -73,31 +145,134 @@ void ram_emu_configure_dma(bool enable) {
 	// RX waddr channel
 	// ----------------
 	volatile uint32_t *rx_waddr_channel_src  = (volatile uint32_t *)&(rx_waddr_psm.pio->rxf[rx_waddr_psm.sm]);
-	volatile uint32_t *rx_waddr_channel_dest = &(dma_channel_hw_addr(rx_wdata_channel)->al2_write_addr_trig);
+	volatile uint32_t *rx_waddr_channel_dest;
+	if (queued_writes) rx_waddr_channel_dest = &write_queue_entry[0];
+	else if (burst_addr) rx_waddr_channel_dest = &(dma_channel_hw_addr(rx_wdata_channel)->al1_write_addr);
+	else rx_waddr_channel_dest = &(dma_channel_hw_addr(rx_wdata_channel)->al2_write_addr_trig);
 
 	dma_channel_config rx_waddr_cfg = dma_channel_get_default_config(rx_waddr_channel);
 
 	channel_config_set_read_increment(&rx_waddr_cfg, false);
+	if (burst_addr) {
+		// {address, count} into {WRITE_ADDR, TRANS_COUNT_TRIG} or the write queue entry
+		channel_config_set_write_increment(&rx_waddr_cfg, true);
+		channel_config_set_ring(&rx_waddr_cfg, true, 3);
+	}
 	if (enable) channel_config_set_dreq(&rx_waddr_cfg, pio_get_dreq(rx_waddr_psm.pio, rx_waddr_psm.sm, false)); // dreq from RX FIFO
 
-	// Start the channel, very big transfer count
-	dma_channel_configure(rx_waddr_channel, &rx_waddr_cfg, rx_waddr_channel_dest, rx_waddr_channel_src, -1, enable);
+	if (queued_writes) {
+		// One address at a time, chain to the write queue channel, which chains back
+		channel_config_set_chain_to(&rx_waddr_cfg, write_queue_channel);
+		dma_channel_configure(rx_waddr_channel, &rx_waddr_cfg, rx_waddr_channel_dest, rx_waddr_channel_src, burst_addr ? 2 : 1, enable);
+	} else {
+		// Start the channel, very big transfer count
+		dma_channel_configure(rx_waddr_channel, &rx_waddr_cfg, rx_waddr_channel_dest, rx_waddr_channel_src, -1, enable);
+	}
+
+	if (count_messages) {
+		// RX wcount channel
+		// -----------------
+		volatile uint32_t *rx_wcount_channel_src  = (volatile uint32_t *)&(rx_wcount_psm.pio->rxf[rx_wcount_psm.sm]);
+		volatile uint32_t *rx_wcount_channel_dest = queued_writes ? &write_queue_entry[1] : &(dma_channel_hw_addr(rx_wdata_channel)->transfer_count);
+
+		dma_channel_config rx_wcount_cfg = dma_channel_get_default_config(rx_wcount_channel);
+
+		channel_config_set_read_increment(&rx_wcount_cfg, false);
+		if (enable) channel_config_set_dreq(&rx_wcount_cfg, pio_get_dreq(rx_wcount_psm.pio, rx_wcount_psm.sm, false)); // dreq from RX FIFO
+
+		// Start the channel, very big transfer count
+		dma_channel_configure(rx_wcount_channel, &rx_wcount_cfg, rx_wcount_channel_dest, rx_wcount_channel_src, -1, enable);
+	}
+
+	if (queued_writes) {
+		// Write queue channel
+		// -------------------
+		// Copies {address, count} into the write queue
+		volatile uint32_t *write_queue_channel_dest = (volatile uint32_t *)&(write_queue_psm.pio->txf[write_queue_psm.sm]);
+		volatile uint32_t *write_queue_channel_src  = write_queue_entry;
+
+		dma_channel_config write_queue_cfg = dma_channel_get_default_config(write_queue_channel);
+
+		channel_config_set_read_increment(&write_queue_cfg, true);
+		channel_config_set_write_increment(&write_queue_cfg, false);
+		channel_config_set_ring(&write_queue_cfg, false, 3); // wrap read address after two words
+		if (enable) channel_config_set_dreq(&write_queue_cfg, pio_get_dreq(write_queue_psm.pio, write_queue_psm.sm, true)); // dreq from TX FIFO
+		channel_config_set_chain_to(&write_queue_cfg, rx_waddr_channel);
+
+		dma_channel_configure(write_queue_channel, &write_queue_cfg, write_queue_channel_dest, write_queue_channel_src, 2, false); // triggered by RX waddr channel
 
-	// RX wcount channel
-	// -----------------
-	volatile uint32_t *rx_wcount_channel_src  = (volatile uint32_t *)&(rx_wcount_psm.pio->rxf[rx_wcount_psm.sm]);
-	volatile uint32_t *rx_wcount_channel_dest = &(dma_channel_hw_addr(rx_wdata_channel)->transfer_count);
+		// RX wdata ctrl channel
+		// ---------------------
+		// Loads the next {address, count} from the write queue into WRITE_ADDR and TRANS_COUNT_TRIG of the RX wdata channel
+		volatile uint32_t *rx_wdata_ctrl_channel_src  = (volatile uint32_t *)&(write_queue_psm.pio->rxf[write_queue_psm.sm]);
+		volatile uint32_t *rx_wdata_ctrl_channel_dest = &(dma_channel_hw_addr(rx_wdata_channel)->al1_write_addr);
 
-	dma_channel_config rx_wcount_cfg = dma_channel_get_default_config(rx_wcount_channel);
+		dma_channel_config rx_wdata_ctrl_cfg = dma_channel_get_default_config(rx_wdata_ctrl_channel);
 
-	channel_config_set_read_increment(&rx_wcount_cfg, false);
-	if (enable) channel_config_set_dreq(&rx_wcount_cfg, pio_get_dreq(rx_wcount_psm.pio, rx_wcount_psm.sm, false)); // dreq from RX FIFO
+		channel_config_set_read_increment(&rx_wdata_ctrl_cfg, false);
+		channel_config_set_write_increment(&rx_wdata_ctrl_cfg, true);
+		channel_config_set_ring(&rx_wdata_ctrl_cfg, true, 3); // wrap write address after AL1_WRITE_ADDR, AL1_TRANS_COUNT_TRIG
+		if (enable) channel_config_set_dreq(&rx_wdata_ctrl_cfg, pio_get_dreq(write_queue_psm.pio, write_queue_psm.sm, false)); // dreq from RX FIFO
 
-	// Start the channel, very big transfer count
-	dma_channel_configure(rx_wcount_channel, &rx_wcount_cfg, rx_wcount_channel_dest, rx_wcount_channel_src, -1, enable);
+		// Start the channel, waits for the first queue entry. Retriggered by the RX wdata channel when it finishes.
+		dma_channel_configure(rx_wdata_ctrl_channel, &rx_wdata_ctrl_cfg, rx_wdata_ctrl_channel_dest, rx_wdata_ctrl_channel_src, 2, enable);
+	}
+
+	if (write_acks) {
+		// Write ack channel
+		// -----------------
+		// Sends ram_emu_write_ack_word through the TX rdata SM, retriggered by the RX wdata channel after each write transaction
+		volatile uint32_t *write_ack_channel_dest = (volatile uint32_t *)&(tx_rdata_psm.pio->txf[tx_rdata_psm.sm]);
+
+		dma_channel_config write_ack_cfg = dma_channel_get_default_config(write_ack_channel);
+
+		channel_config_set_read_increment(&write_ack_cfg, false);
+		channel_config_set_write_increment(&write_ack_cfg, false);
+		if (enable) channel_config_set_dreq(&write_ack_cfg, pio_get_dreq(tx_rdata_psm.pio, tx_rdata_psm.sm, true)); // dreq from TX FIFO
+		channel_config_set_transfer_data_size(&write_ack_cfg, (ram_emu_flags & RAM_EMU_FLAG_LONG_WORDS) ? DMA_SIZE_32 : DMA_SIZE_16);
+		if (queued_writes) channel_config_set_chain_to(&write_ack_cfg, rx_wdata_ctrl_channel);
+
+		dma_channel_configure(write_ack_channel, &write_ack_cfg, write_ack_channel_dest, &ram_emu_write_ack_word, 1, false); // triggered by RX wdata channel
+	}
+
+	if (ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES) {
+		// Byte writes
+		// ===========
+		// The byte write SM pushes {byte address, data}. The RX bwaddr channel moves the byte address to WRITE_ADDR_TRIG of the RX bwdata channel,
+		// which moves the data byte into emu_ram and then chains back to the RX bwaddr channel.
+		volatile uint32_t *rx_bwrite_fifo = (volatile uint32_t *)&(rx_bwrite_psm.pio->rxf[rx_bwrite_psm.sm]);
+
+		// RX bwdata channel
+		// -----------------
+		dma_channel_config rx_bwdata_cfg = dma_channel_get_default_config(rx_bwdata_channel);
+
+		channel_config_set_read_increment(&rx_bwdata_cfg, false);
+		channel_config_set_write_increment(&rx_bwdata_cfg, false);
+		if (enable) channel_config_set_dreq(&rx_bwdata_cfg, pio_get_dreq(rx_bwrite_psm.pio, rx_bwrite_psm.sm, false)); // dreq from RX FIFO
+		channel_config_set_transfer_data_size(&rx_bwdata_cfg, DMA_SIZE_8);
+		channel_config_set_chain_to(&rx_bwdata_cfg, rx_bwaddr_channel);
+
+		dma_channel_configure(rx_bwdata_channel, &rx_bwdata_cfg, emu_ram, rx_bwrite_fifo, 1, false); // trans_count = 1, don't start
+
+		// RX bwaddr channel
+		// -----------------
+		volatile uint32_t *rx_bwaddr_channel_dest = &(dma_channel_hw_addr(rx_bwdata_channel)->al2_write_addr_trig);
+
+		dma_channel_config rx_bwaddr_cfg = dma_channel_get_default_config(rx_bwaddr_channel);
+
+		channel_config_set_read_increment(&rx_bwaddr_cfg, false);
+		if (enable) channel_config_set_dreq(&rx_bwaddr_cfg, pio_get_dreq(rx_bwrite_psm.pio, rx_bwrite_psm.sm, false)); // dreq from RX FIFO
+
+		// One byte address at a time, retriggered by the RX bwdata channel
+		dma_channel_configure(rx_bwaddr_channel, &rx_bwaddr_cfg, rx_bwaddr_channel_dest, rx_bwrite_fifo, 1, enable);
+	}
 
 	// Reading
 	// =======
+	// With RAM_EMU_FLAG_QUEUED_READS, the read address and count don't go directly to the TX rdata channel:
+	// each received read address is paired with the current read count and pushed into the read queue (a PIO FIFO),
+	// and the TX rdata channel chains to the TX rdata ctrl channel, which loads the next pair from the queue into it.
+	bool queued_reads = ram_emu_flags & RAM_EMU_FLAG_QUEUED_READS;
 
 	// TX rdata channel
 	// ----------------
@@ -109,7 +284,9 @@ void ram_emu_configure_dma(bool enable) {
 	channel_config_set_read_increment(&tx_rdata_cfg, true);
 	channel_config_set_write_increment(&tx_rdata_cfg, false);
 	if (enable) channel_config_set_dreq(&tx_rdata_cfg, pio_get_dreq(tx_rdata_psm.pio, tx_rdata_psm.sm, true)); // dreq from TX FIFO
-	channel_config_set_transfer_data_size(&tx_rdata_cfg, DMA_SIZE_16);
+	channel_config_set_transfer_data_size(&tx_rdata_cfg, (ram_emu_flags & RAM_EMU_FLAG_LONG_WORDS) ? DMA_SIZE_32 : DMA_SIZE_16);
+	if (queued_reads) channel_config_set_chain_to(&tx_rdata_cfg, tx_rdata_ctrl_channel);
+	if (read_ring_bits) channel_config_set_ring(&tx_rdata_cfg, false, read_ring_bits); // see ram_emu_set_ring_windows
 
 	//dma_channel_configure(tx_rdata_channel, &tx_rdata_cfg, tx_rdata_channel_dest, tx_rdata_channel_src, sizeof(emu_ram)/2, true); // Start the channel, very big transfer count
 	dma_channel_configure(tx_rdata_channel, &tx_rdata_cfg, tx_rdata_channel_dest, tx_rdata_channel_src, 1, false); // trans_count = 1, don't start
@@ -117,42 +294,1066 @@ void ram_emu_configure_dma(bool enable) {
 	// RX raddr channel
 	// ----------------
 	volatile uint32_t *rx_raddr_channel_src  = (volatile uint32_t *)&(rx_raddr_psm.pio->rxf[rx_raddr_psm.sm]);
-	volatile uint32_t *rx_raddr_channel_dest = &(dma_channel_hw_addr(tx_rdata_channel)->al3_read_addr_trig);
+	volatile uint32_t *rx_raddr_channel_dest = (queued_reads || burst_addr) ? &read_queue_entry[1] : &(dma_channel_hw_addr(tx_rdata_channel)->al3_read_addr_trig);
 
 	dma_channel_config rx_raddr_cfg = dma_channel_get_default_config(rx_raddr_channel);
 
 	channel_config_set_read_increment(&rx_raddr_cfg, false);
+	if (burst_addr) {
+		// {address, count} into read_queue_entry[1], read_queue_entry[0]: start at the second word and wrap around
+		channel_config_set_write_increment(&rx_raddr_cfg, true);
+		channel_config_set_ring(&rx_raddr_cfg, true, 3);
+	}
 	if (enable) channel_config_set_dreq(&rx_raddr_cfg, pio_get_dreq(rx_raddr_psm.pio, rx_raddr_psm.sm, false)); // dreq from RX FIFO
 
-	// Start the channel, very big transfer count
-	dma_channel_configure(rx_raddr_channel, &rx_raddr_cfg, rx_raddr_channel_dest, rx_raddr_channel_src, -1, enable);
+	if (queued_reads || burst_addr) {
+		// One address at a time, chain to the read queue channel, which chains back
+		channel_config_set_chain_to(&rx_raddr_cfg, read_queue_channel);
+		dma_channel_configure(rx_raddr_channel, &rx_raddr_cfg, rx_raddr_channel_dest, rx_raddr_channel_src, burst_addr ? 2 : 1, enable);
+	} else {
+		// Start the channel, very big transfer count
+		dma_channel_configure(rx_raddr_channel, &rx_raddr_cfg, rx_raddr_channel_dest, rx_raddr_channel_src, -1, enable);
+	}
+
+	if (count_messages) {
+		// RX rcount channel
+		// -----------------
+		volatile uint32_t *rx_rcount_channel_src  = (volatile uint32_t *)&(rx_rcount_psm.pio->rxf[rx_rcount_psm.sm]);
+		volatile uint32_t *rx_rcount_channel_dest = queued_reads ? &read_queue_entry[0] : &(dma_channel_hw_addr(tx_rdata_channel)->transfer_count);
+
+		dma_channel_config rx_rcount_cfg = dma_channel_get_default_config(rx_rcount_channel);
+
+		channel_config_set_read_increment(&rx_rcount_cfg, false);
+		if (enable) channel_config_set_dreq(&rx_rcount_cfg, pio_get_dreq(rx_rcount_psm.pio, rx_rcount_psm.sm, false)); // dreq from RX FIFO
+
+		// Start the channel, very big transfer count
+		dma_channel_configure(rx_rcount_channel, &rx_rcount_cfg, rx_rcount_channel_dest, rx_rcount_channel_src, -1, enable);
+	}
 
-	// RX rcount channel
-	// -----------------
-	volatile uint32_t *rx_rcount_channel_src  = (volatile uint32_t *)&(rx_rcount_psm.pio->rxf[rx_rcount_psm.sm]);
-	volatile uint32_t *rx_rcount_channel_dest = &(dma_channel_hw_addr(tx_rdata_channel)->transfer_count);
+	if (ram_emu_flags & RAM_EMU_FLAG_CONTINUE_READS) {
+		// Continue reads
+		// ==============
+		// The continue read channel pops each continue read message and chains to the continue trigger channel, which retriggers
+		// the TX rdata channel through MULTI_CHAN_TRIGGER. It resumes at its current read address (just past the previous burst)
+		// with the reloaded transfer count, and then chains back to the continue read channel.
 
-	dma_channel_config rx_rcount_cfg = dma_channel_get_default_config(rx_rcount_channel);
+		// Continue trigger channel
+		// ------------------------
+		continue_read_trigger = 1u << tx_rdata_channel;
 
-	channel_config_set_read_increment(&rx_rcount_cfg, false);
-	if (enable) channel_config_set_dreq(&rx_rcount_cfg, pio_get_dreq(rx_rcount_psm.pio, rx_rcount_psm.sm, false)); // dreq from RX FIFO
+		dma_channel_config continue_trigger_cfg = dma_channel_get_default_config(continue_trigger_channel);
 
-	// Start the channel, very big transfer count
-	dma_channel_configure(rx_rcount_channel, &rx_rcount_cfg, rx_rcount_channel_dest, rx_rcount_channel_src, -1, enable);
+		channel_config_set_read_increment(&continue_trigger_cfg, false);
+		channel_config_set_write_increment(&continue_trigger_cfg, false);
+		channel_config_set_chain_to(&continue_trigger_cfg, continue_read_channel);
+
+		dma_channel_configure(continue_trigger_channel, &continue_trigger_cfg, &dma_hw->multi_channel_trigger, &continue_read_trigger, 1, false); // triggered by continue read channel
+
+		// Continue read channel
+		// ---------------------
+		volatile uint32_t *continue_read_channel_src = (volatile uint32_t *)&(rx_continue_psm.pio->rxf[rx_continue_psm.sm]);
+
+		dma_channel_config continue_read_cfg = dma_channel_get_default_config(continue_read_channel);
+
+		channel_config_set_read_increment(&continue_read_cfg, false);
+		channel_config_set_write_increment(&continue_read_cfg, false);
+		if (enable) channel_config_set_dreq(&continue_read_cfg, pio_get_dreq(rx_continue_psm.pio, rx_continue_psm.sm, false)); // dreq from RX FIFO
+		channel_config_set_chain_to(&continue_read_cfg, continue_trigger_channel);
+
+		// One message at a time, retriggered by the continue trigger channel
+		dma_channel_configure(continue_read_channel, &continue_read_cfg, &continue_read_sink, continue_read_channel_src, 1, enable);
+	}
+
+	if (!queued_reads && !burst_addr) return;
+
+	// Read queue channel
+	// ------------------
+	// Copies {count, address} into the read queue,
+	// or directly into TRANS_COUNT and READ_ADDR_TRIG of the TX rdata channel if there is no read queue (RAM_EMU_FLAG_BURST_ADDR only)
+	volatile uint32_t *read_queue_channel_dest = queued_reads ? (volatile uint32_t *)&(read_queue_psm.pio->txf[read_queue_psm.sm]) : &(dma_channel_hw_addr(tx_rdata_channel)->al3_transfer_count);
+	volatile uint32_t *read_queue_channel_src  = read_queue_entry;
+
+	dma_channel_config read_queue_cfg = dma_channel_get_default_config(read_queue_channel);
+
+	channel_config_set_read_increment(&read_queue_cfg, true);
+	channel_config_set_ring(&read_queue_cfg, false, 3); // wrap read address after two words
+	if (queued_reads) {
+		channel_config_set_write_increment(&read_queue_cfg, false);
+		if (enable) channel_config_set_dreq(&read_queue_cfg, pio_get_dreq(read_queue_psm.pio, read_queue_psm.sm, true)); // dreq from TX FIFO
+	} else {
+		channel_config_set_write_increment(&read_queue_cfg, true);
+		channel_config_set_ring(&read_queue_cfg, true, 3); // wrap write address after AL3_TRANS_COUNT, AL3_READ_ADDR_TRIG
+	}
+	channel_config_set_chain_to(&read_queue_cfg, rx_raddr_channel);
+
+	dma_channel_configure(read_queue_channel, &read_queue_cfg, read_queue_channel_dest, read_queue_channel_src, 2, false); // triggered by RX raddr channel
+
+	if (!queued_reads) return;
+
+	// TX rdata ctrl channel
+	// ---------------------
+	// Loads the next {count, address} from the read queue into TRANS_COUNT and READ_ADDR_TRIG of the TX rdata channel
+	volatile uint32_t *tx_rdata_ctrl_channel_src  = (volatile uint32_t *)&(read_queue_psm.pio->rxf[read_queue_psm.sm]);
+	volatile uint32_t *tx_rdata_ctrl_channel_dest = &(dma_channel_hw_addr(tx_rdata_channel)->al3_transfer_count);
+
+	dma_channel_config tx_rdata_ctrl_cfg = dma_channel_get_default_config(tx_rdata_ctrl_channel);
+
+	channel_config_set_read_increment(&tx_rdata_ctrl_cfg, false);
+	channel_config_set_write_increment(&tx_rdata_ctrl_cfg, true);
+	channel_config_set_ring(&tx_rdata_ctrl_cfg, true, 3); // wrap write address after AL3_TRANS_COUNT, AL3_READ_ADDR_TRIG
+	if (enable) channel_config_set_dreq(&tx_rdata_ctrl_cfg, pio_get_dreq(read_queue_psm.pio, read_queue_psm.sm, false)); // dreq from RX FIFO
+
+	// Start the channel, waits for the first queue entry. Retriggered by the TX rdata channel when it finishes.
+	dma_channel_configure(tx_rdata_ctrl_channel, &tx_rdata_ctrl_cfg, tx_rdata_ctrl_channel_dest, tx_rdata_ctrl_channel_src, 2, enable);
 }
 
 void ram_emu_stop_dma() {
 	dma_channel_abort(rx_wdata_channel);
 	dma_channel_abort(rx_waddr_channel);
-	dma_channel_abort(rx_wcount_channel);
+	if (!(ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR)) dma_channel_abort(rx_wcount_channel);
 
 	dma_channel_abort(tx_rdata_channel);
 	dma_channel_abort(rx_raddr_channel);
-	dma_channel_abort(rx_rcount_channel);
+	if (!(ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR)) dma_channel_abort(rx_rcount_channel);
+
+	if (ram_emu_flags & (RAM_EMU_FLAG_QUEUED_READS | RAM_EMU_FLAG_BURST_ADDR)) dma_channel_abort(read_queue_channel);
+	if (ram_emu_flags & RAM_EMU_FLAG_QUEUED_READS) dma_channel_abort(tx_rdata_ctrl_channel);
+	if (ram_emu_flags & RAM_EMU_FLAG_QUEUED_WRITES) {
+		dma_channel_abort(write_queue_channel);
+		dma_channel_abort(rx_wdata_ctrl_channel);
+	}
+	if (ram_emu_flags & RAM_EMU_FLAG_WRITE_ACKS) dma_channel_abort(write_ack_channel);
+	if (ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES) {
+		dma_channel_abort(rx_bwaddr_channel);
+		dma_channel_abort(rx_bwdata_channel);
+	}
+	if (ram_emu_flags & RAM_EMU_FLAG_CONTINUE_READS) {
+		dma_channel_abort(continue_read_channel);
+		dma_channel_abort(continue_trigger_channel);
+	}
+}
+
+
+// Copy the image linked into flash (see RAM_EMU_IMAGE in CMakeLists.txt) to the start of emu_ram and clear the rest, using DMA.
+// Call before releasing the user design from reset. Returns the number of 16 bit words copied from the image.
+int ram_emu_load_image() {
+	extern const uint32_t __spi_ram_image_start__[], __spi_ram_image_end__[];
+	static const uint32_t zero = 0;
+
+	int image_words = __spi_ram_image_end__ - __spi_ram_image_start__;
+	int total_words = sizeof(emu_ram) / 4;
+
+	int channel = dma_claim_unused_channel(true);
+	dma_channel_config cfg = dma_channel_get_default_config(channel);
+	channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+	channel_config_set_read_increment(&cfg, true);
+	channel_config_set_write_increment(&cfg, true);
+
+	// Image, read through the XIP cache
+	if (image_words > 0) {
+		dma_channel_configure(channel, &cfg, emu_ram, __spi_ram_image_start__, image_words, true);
+		dma_channel_wait_for_finish_blocking(channel);
+	}
+	// Rest
+	channel_config_set_read_increment(&cfg, false);
+	dma_channel_configure(channel, &cfg, ((uint32_t *)emu_ram) + image_words, &zero, total_words - image_words, true);
+	dma_channel_wait_for_finish_blocking(channel);
+
+	dma_channel_unclaim(channel);
+	return image_words * 2;
+}
+
+// Switch the buffer used by the read path and/or the write path (NULL = keep the current one), e.g. to flip pages without copying.
+// Buffers must be aligned to 128 kB. The change takes effect from the next address message for each path,
+// so a transaction is never split between buffers. Byte writes (RAM_EMU_FLAG_BYTE_WRITES) follow the write path.
+// Returns false (and changes nothing) if a buffer is misaligned or an address SM has too many changes pending,
+// and always with RAM_EMU_FLAG_SINGLE_PIO: the compact address SMs keep the top address bits in Y, set once at init.
+bool ram_emu_set_base(uint16_t *read_base, uint16_t *write_base) {
+	if (ram_emu_flags & RAM_EMU_FLAG_SINGLE_PIO) return false; // the compact address SMs can't take a new base
+	if ((((int)read_base) | ((int)write_base)) & ((1 << 17) - 1)) return false;
+	if (read_base  && pio_sm_is_tx_fifo_full(rx_raddr_psm.pio, rx_raddr_psm.sm)) return false;
+	if (write_base && pio_sm_is_tx_fifo_full(rx_waddr_psm.pio, rx_waddr_psm.sm)) return false;
+	bool byte_writes = ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES;
+	if (write_base && byte_writes && pio_sm_is_tx_fifo_full(rx_bwrite_psm.pio, rx_bwrite_psm.sm)) return false;
+
+	// The address SMs pick up new top address bits from their TX FIFOs right after the start bit of each message
+	// (with RAM_EMU_FLAG_BACK_TO_BACK, just before they push the address)
+	if (read_base) {
+		pio_sm_put(rx_raddr_psm.pio, rx_raddr_psm.sm, ((int)read_base)>>17);
+		ram_emu_read_base = read_base;
+	}
+	if (write_base) {
+		pio_sm_put(rx_waddr_psm.pio, rx_waddr_psm.sm, ((int)write_base)>>17);
+		if (byte_writes) pio_sm_put(rx_bwrite_psm.pio, rx_bwrite_psm.sm, ((int)write_base)>>17); // likewise from the next byte write
+		ram_emu_write_base = write_base;
+	}
+	return true;
+}
+
+
+// Measure the read latency: the user design should send num_samples single word reads, spaced well apart,
+// and no other RX messages while this runs.
+// Stores the min and max latency (in FPGA cycles, start bit to start bit) in ram_emu_read_latency_min/max,
+// and in emu_ram[report_addr] and emu_ram[report_addr + 1] (unless report_addr < 0), so that the user design can read them back.
+// Returns the max latency, or -1 if no samples were received within timeout_us each.
+int ram_emu_calibrate_latency(int num_samples, int timeout_us, int report_addr) {
+	return ram_emu_calibrate_latency_loaded(num_samples, timeout_us, report_addr, NULL);
 }
 
+// Same as ram_emu_calibrate_latency, but calls load() repeatedly while waiting for each sample (unless NULL),
+// e.g. to measure how the latency is affected by CPU memory traffic. load() should return quickly.
+int ram_emu_calibrate_latency_loaded(int num_samples, int timeout_us, int report_addr, void (*load)(void)) {
+	PSM probe_psm;
+	PSM *psm = &probe_psm;
+	if (!add_psm(psm, pio1, &sbio2_latency_probe_program)) return -1;
+	sbio2_latency_probe_program_init(psm->pio, psm->sm, psm->offset, ram_emu_rx_pin_base + 1, ram_emu_tx_pin_base);
+
+	int min_latency = 0x7fffffff, max_latency = -1;
+	for (int i = 0; i < num_samples; i++) {
+		pio_sm_put(psm->pio, psm->sm, 0); // arm
+
+		absolute_time_t timeout = make_timeout_time_us(timeout_us);
+		while (pio_sm_is_rx_fifo_empty(psm->pio, psm->sm) && !time_reached(timeout)) {
+			if (load != NULL) load(); else tight_loop_contents();
+		}
+		if (pio_sm_is_rx_fifo_empty(psm->pio, psm->sm)) break;
+
+		int latency = pio_sm_get(psm->pio, psm->sm);
+		if (latency < min_latency) min_latency = latency;
+		if (latency > max_latency) max_latency = latency;
+	}
+
+	pio_sm_set_enabled(psm->pio, psm->sm, false);
+	pio_sm_unclaim(psm->pio, psm->sm);
+	pio_remove_program(psm->pio, &sbio2_latency_probe_program, psm->offset);
+
+	if (max_latency < 0) return -1;
+
+	ram_emu_read_latency_min = min_latency;
+	ram_emu_read_latency_max = max_latency;
+	if (report_addr >= 0) {
+		emu_ram[report_addr & (emu_ram_elements - 1)] = max_latency;
+		emu_ram[(report_addr + 1) & (emu_ram_elements - 1)] = min_latency;
+	}
+	return max_latency;
+}
+
+
+// Fixed latency
+// =============
+// With RAM_EMU_FLAG_FIXED_LATENCY, sbio2_tx_fixed pushes a word to its RX FIFO for each response that missed the deadline
+static void fixed_latency_irq_handler() {
+	PIO pio = tx_rdata_psm.pio;
+	uint sm = tx_rdata_psm.sm;
+	while (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+		pio_sm_get(pio, sm);
+		ram_emu_fixed_latency_misses++;
+	}
+}
+
+static void init_fixed_latency_irq() {
+	PIO pio = tx_rdata_psm.pio;
+	uint irq = pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0;
+	irq_add_shared_handler(irq, fixed_latency_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY); // shared with the frame clock
+	pio_set_irq0_source_enabled(pio, pis_sm0_rx_fifo_not_empty + tx_rdata_psm.sm, true);
+	irq_set_enabled(irq, true);
+}
+
+// Set the read latency for RAM_EMU_FLAG_FIXED_LATENCY, in FPGA cycles from the start bit of a send read address message
+// to the start bit of the response, counted as described for NONLOOP_CYCLES in serial-ram-emu.pio (the same for both RX clock polarities).
+// Returns false (and changes nothing) if the flag is not set, the latency is below sbio2_tx_fixed_NONLOOP_CYCLES,
+// or sbio2_tx_fixed is busy: receiving or skipping a message on rx[1], or with a read in progress (counting down, or with read data
+// in the TX FIFO). Call it again later then.
+bool ram_emu_set_fixed_latency(int latency) {
+	if (!(ram_emu_flags & RAM_EMU_FLAG_FIXED_LATENCY) || latency < sbio2_tx_fixed_NONLOOP_CYCLES) return false;
+
+	// Stop the SM where it is, and only go on if it is waiting for a start bit (the program starts with clock_sync)
+	const PSM *psm = &tx_rdata_psm;
+	pio_sm_set_enabled(psm->pio, psm->sm, false);
+	uint pc = pio_sm_get_pc(psm->pio, psm->sm) - psm->offset;
+	if (pc > sbio2_tx_fixed_offset_wait_start_bit || !pio_sm_is_tx_fifo_empty(psm->pio, psm->sm)) {
+		pio_sm_set_enabled(psm->pio, psm->sm, true);
+		return false;
+	}
+	ram_emu_fixed_latency = latency;
+
+	// Load the new countdown into X through the empty TX FIFO, and restart at the synchronization point
+	pio_sm_restart(psm->pio, psm->sm);
+	pio_sm_put(psm->pio, psm->sm, latency - sbio2_tx_fixed_NONLOOP_CYCLES);
+	pio_sm_exec(psm->pio, psm->sm, pio_encode_pull(false, true));
+	pio_sm_exec(psm->pio, psm->sm, pio_encode_mov(pio_x, pio_osr));
+	pio_sm_exec(psm->pio, psm->sm, pio_encode_jmp(psm->offset + sbio2_tx_fixed_offset_clock_sync));
+	pio_sm_set_enabled(psm->pio, psm->sm, true);
+	return true;
+}
+
+
+// Doorbell
+// ========
+static ram_emu_doorbell_handler_t doorbell_handlers[RAM_EMU_DOORBELL_NUM_HANDLERS];
+
+volatile int ram_emu_doorbell_dispatch_cycles_max = -1, ram_emu_doorbell_done_cycles_max = -1;
+
+void ram_emu_set_doorbell_handler(int index, ram_emu_doorbell_handler_t handler) {
+	doorbell_handlers[index & (RAM_EMU_DOORBELL_NUM_HANDLERS - 1)] = handler;
+}
+
+static void __not_in_flash_func(doorbell_irq_handler)() {
+	uint32_t start = systick_hw->cvr;
+
+	PIO pio = rx_doorbell_psm.pio;
+	uint sm = rx_doorbell_psm.sm;
+	while (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+		uint16_t command = pio_sm_get(pio, sm);
+		volatile uint16_t *mailbox = emu_ram + (command & 0xfff)*RAM_EMU_DOORBELL_MAILBOX_WORDS;
+		ram_emu_doorbell_handler_t handler = doorbell_handlers[command >> 12];
+
+		// SysTick counts down
+		int dispatch_cycles = (start - systick_hw->cvr) & 0xffffff;
+		if (dispatch_cycles > ram_emu_doorbell_dispatch_cycles_max) ram_emu_doorbell_dispatch_cycles_max = dispatch_cycles;
+
+		if (handler != NULL) handler(mailbox);
+		__dmb(); // results before the completion flag
+		mailbox[0] = handler != NULL ? RAM_EMU_DOORBELL_DONE : RAM_EMU_DOORBELL_NO_HANDLER;
+
+		int done_cycles = (start - systick_hw->cvr) & 0xffffff;
+		if (done_cycles > ram_emu_doorbell_done_cycles_max) ram_emu_doorbell_done_cycles_max = done_cycles;
+		start = systick_hw->cvr; // don't count the wait for a queued command
+	}
+}
+
+// Entry point for core1 (multicore_launch_core1), when RAM_EMU_FLAG_DOORBELL is used.
+// Handles doorbell messages in an interrupt on core1, so that the handlers don't have to compete with core0.
+// Uses the SysTick timer of core1 to measure the dispatch latency.
+void ram_emu_doorbell_core1_main() {
+	systick_hw->rvr = 0xffffff;
+	systick_hw->cvr = 0;
+	systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS; // count processor cycles
+
+	PIO pio = rx_doorbell_psm.pio;
+	uint irq = pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1;
+	irq_set_exclusive_handler(irq, doorbell_irq_handler);
+	pio_set_irq1_source_enabled(pio, pis_sm0_rx_fifo_not_empty + rx_doorbell_psm.sm, true);
+	irq_set_enabled(irq, true);
+
+	while (true) __wfi();
+}
+
+
+// Ring windows
+// ============
+// Make read and/or write transactions wrap around within aligned windows of 2^log2_words words (0 = no wrapping, max 14),
+// using the DMA address wrap of the TX rdata and RX wdata channels. A burst that reaches the end of its window continues
+// at the start of the same window, so the user design can keep rings in emu_ram without splitting bursts.
+// Applies to all transactions: those that shouldn't wrap must not cross a window boundary.
+// Can be called while the emulator is running, but should only be called when no read/write transaction is in progress.
+// Returns false (and changes nothing) if a size is out of range.
+bool ram_emu_set_ring_windows(int read_log2_words, int write_log2_words) {
+	if (read_log2_words < 0 || read_log2_words > 14 || write_log2_words < 0 || write_log2_words > 14) return false;
+	read_ring_bits  = read_log2_words  ? read_log2_words + 1 : 0;
+	write_ring_bits = write_log2_words ? write_log2_words + 1 : 0;
+
+	// Update CTRL without triggering the channels
+	const uint32_t mask = DMA_CH0_CTRL_TRIG_RING_SIZE_BITS | DMA_CH0_CTRL_TRIG_RING_SEL_BITS;
+	hw_write_masked(&dma_hw->ch[tx_rdata_channel].al1_ctrl, read_ring_bits << DMA_CH0_CTRL_TRIG_RING_SIZE_LSB, mask);
+	hw_write_masked(&dma_hw->ch[rx_wdata_channel].al1_ctrl, (write_ring_bits << DMA_CH0_CTRL_TRIG_RING_SIZE_LSB) | DMA_CH0_CTRL_TRIG_RING_SEL_BITS, mask);
+	return true;
+}
+
+void ram_emu_doorbell_set_ring_windows(volatile uint16_t *mailbox) {
+	mailbox[3] = ram_emu_set_ring_windows(mailbox[1], mailbox[2]);
+}
+
+
+// Checksum
+// ========
+// Compute a checksum over num_words words of emu_ram starting at addr (wrapping around at the end),
+// using the DMA sniffer during a memory to null transfer:
+// - RAM_EMU_CHECKSUM_CRC32: standard CRC-32 (as in zlib) over the bytes, low byte of each word first
+// - RAM_EMU_CHECKSUM_SUM:   32 bit sum of the words
+// Blocks until done, about one cycle per byte (CRC32) or word (sum). The sniffer is shared, don't use it elsewhere at the same time.
+uint32_t ram_emu_checksum(int addr, int num_words, int mode) {
+	static uint32_t sink;
+
+	addr &= emu_ram_elements - 1;
+	bool crc = mode == RAM_EMU_CHECKSUM_CRC32;
+
+	int channel = dma_claim_unused_channel(true);
+	dma_channel_config cfg = dma_channel_get_default_config(channel);
+	channel_config_set_transfer_data_size(&cfg, crc ? DMA_SIZE_8 : DMA_SIZE_16);
+	channel_config_set_read_increment(&cfg, true);
+	channel_config_set_write_increment(&cfg, false);
+	channel_config_set_sniff_enable(&cfg, true);
+
+	// CRC-32 with bit reversed data, and reversed and inverted output, gives the standard CRC-32
+	dma_sniffer_enable(channel, crc ? 0x1 : 0xf, true);
+	if (crc) hw_set_bits(&dma_hw->sniff_ctrl, DMA_SNIFF_CTRL_OUT_REV_BITS | DMA_SNIFF_CTRL_OUT_INV_BITS);
+	else hw_clear_bits(&dma_hw->sniff_ctrl, DMA_SNIFF_CTRL_OUT_REV_BITS | DMA_SNIFF_CTRL_OUT_INV_BITS);
+	dma_hw->sniff_data = crc ? 0xffffffff : 0;
+
+	// Two parts if the range wraps around
+	while (num_words > 0) {
+		int n = MIN(num_words, emu_ram_elements - addr);
+		dma_channel_configure(channel, &cfg, &sink, emu_ram + addr, crc ? 2*n : n, true);
+		dma_channel_wait_for_finish_blocking(channel);
+		num_words -= n;
+		addr = 0;
+	}
+	uint32_t result = dma_hw->sniff_data;
+
+	dma_sniffer_disable();
+	dma_channel_unclaim(channel);
+	return result;
+}
+
+void ram_emu_doorbell_checksum(volatile uint16_t *mailbox) {
+	int num_words = mailbox[2];
+	if (num_words == 0) num_words = emu_ram_elements;
+	uint32_t result = ram_emu_checksum(mailbox[1], num_words, mailbox[3]);
+	mailbox[4] = result;
+	mailbox[5] = result >> 16;
+}
+
+
+// Affine fetch
+// ============
+// Send num_pixels texels along a line through texture space, starting at (u, v) and stepping by (du, dv) per pixel,
+// as one burst of get read data messages. The texture is 2^log2_width x 2^log2_height words in emu_ram at texture_addr,
+// row by row, and wraps around in both directions. Coordinates are fixed point with RAM_EMU_AFFINE_FRAC_BITS fraction bits.
+// interp0 of the calling core computes the texel addresses, so the loop is just a load and a FIFO write per pixel.
+// The texels share the TX FIFO with read data: the user design must not have reads outstanding while a span is sent.
+// Blocks until the last texel is in the TX FIFO. Returns false if the texture doesn't fit.
+volatile uint32_t ram_emu_affine_pixels, ram_emu_affine_busy_us;
+
+bool __not_in_flash_func(ram_emu_affine_fetch)(int texture_addr, int log2_width, int log2_height, uint32_t u, uint32_t v, int32_t du, int32_t dv, int num_pixels) {
+	if (log2_width < 1 || log2_width > 15 || log2_height < 1 || log2_width + log2_height > 16) return false;
+	if (texture_addr < 0 || texture_addr + (1 << (log2_width + log2_height)) > emu_ram_elements) return false;
+
+	uint32_t start = time_us_32();
+
+	// Lane 0: column byte offset from u, lane 1: row byte offset from v, full result: texel address.
+	// With add_raw, popping the full result steps u and v by the unshifted base values.
+	interp_config cfg = interp_default_config();
+	interp_config_set_add_raw(&cfg, true);
+	interp_config_set_shift(&cfg, RAM_EMU_AFFINE_FRAC_BITS - 1);
+	interp_config_set_mask(&cfg, 1, log2_width);
+	interp_set_config(interp0, 0, &cfg);
+	interp_config_set_shift(&cfg, RAM_EMU_AFFINE_FRAC_BITS - 1 - log2_width);
+	interp_config_set_mask(&cfg, log2_width + 1, log2_width + log2_height);
+	interp_set_config(interp0, 1, &cfg);
+
+	interp0->accum[0] = u;
+	interp0->base[0] = du;
+	interp0->accum[1] = v;
+	interp0->base[1] = dv;
+	interp0->base[2] = (uint32_t)(emu_ram + texture_addr);
+
+	PIO pio = tx_rdata_psm.pio;
+	uint sm = tx_rdata_psm.sm;
+	for (int i = 0; i < num_pixels; i++) {
+		uint16_t texel = *(volatile uint16_t *)interp0->pop[2];
+		while (pio_sm_is_tx_fifo_full(pio, sm)) tight_loop_contents();
+		pio->txf[sm] = texel;
+	}
+
+	ram_emu_affine_pixels += num_pixels;
+	ram_emu_affine_busy_us += time_us_32() - start;
+	return true;
+}
+
+void ram_emu_doorbell_affine_fetch(volatile uint16_t *mailbox) {
+	int num_pixels = mailbox[11];
+	if (num_pixels == 0) num_pixels = 65536;
+	mailbox[12] = ram_emu_affine_fetch(mailbox[1], mailbox[2] & 0xff, mailbox[2] >> 8,
+		mailbox[3] | (mailbox[4] << 16), mailbox[5] | (mailbox[6] << 16),
+		mailbox[7] | (mailbox[8] << 16), mailbox[9] | (mailbox[10] << 16), num_pixels);
+}
+
+
+// Assets
+// ======
+// Archive built by host/pack-assets.py, see the format description there
+typedef struct {
+	char name[16];
+	uint32_t offset, packed_size, size, method;
+} asset_entry_t;
+
+static const uint32_t ASSET_ARCHIVE_MAGIC = 0x41454152; // "RAEA"
+
+extern const uint32_t __ram_emu_assets_start__[], __ram_emu_assets_end__[];
+
+static const asset_entry_t *asset_directory(int *num_assets) {
+	*num_assets = 0;
+	if (__ram_emu_assets_end__ - __ram_emu_assets_start__ < 2 || __ram_emu_assets_start__[0] != ASSET_ARCHIVE_MAGIC) return NULL;
+	*num_assets = __ram_emu_assets_start__[1];
+	return (const asset_entry_t *)(__ram_emu_assets_start__ + 2);
+}
+
+// Byte oriented RLE: c < 128: c+1 literal bytes follow, c >= 128: the next byte repeated c-126 times
+static int rle_decompress(const uint8_t *src, int src_size, uint8_t *dst, int dst_size) {
+	const uint8_t *src_end = src + src_size;
+	uint8_t *d = dst, *dst_end = dst + dst_size;
+	while (src < src_end) {
+		int c = *src++;
+		if (c < 128) {
+			int len = c + 1;
+			if (len > src_end - src || len > dst_end - d) return -1;
+			memcpy(d, src, len);
+			src += len;
+			d += len;
+		} else {
+			int len = c - 126;
+			if (src >= src_end || len > dst_end - d) return -1;
+			memset(d, *src++, len);
+			d += len;
+		}
+	}
+	return d - dst;
+}
+
+static bool lz4_length(const uint8_t **src, const uint8_t *src_end, int *len) {
+	if (*len != 15) return true;
+	int b;
+	do {
+		if (*src >= src_end) return false;
+		b = *(*src)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+// LZ4 block format (no frame)
+static int lz4_decompress(const uint8_t *src, int src_size, uint8_t *dst, int dst_size) {
+	const uint8_t *src_end = src + src_size;
+	uint8_t *d = dst, *dst_end = dst + dst_size;
+	while (src < src_end) {
+		int token = *src++;
+
+		int len = token >> 4;
+		if (!lz4_length(&src, src_end, &len) || len > src_end - src || len > dst_end - d) return -1;
+		memcpy(d, src, len);
+		src += len;
+		d += len;
+		if (src == src_end) break; // the last sequence has no match
+
+		if (src_end - src < 2) return -1;
+		int offset = src[0] | (src[1] << 8);
+		src += 2;
+		len = token & 15;
+		if (offset == 0 || offset > d - dst || !lz4_length(&src, src_end, &len)) return -1;
+		len += 4;
+		if (len > dst_end - d) return -1;
+		const uint8_t *m = d - offset;
+		while (len--) *d++ = *m++; // byte by byte, matches can overlap
+	}
+	return d - dst;
+}
+
+int ram_emu_num_assets() {
+	int num_assets;
+	asset_directory(&num_assets);
+	return num_assets;
+}
+
+int ram_emu_find_asset(const char *name) {
+	int num_assets;
+	const asset_entry_t *directory = asset_directory(&num_assets);
+	for (int i = 0; i < num_assets; i++) {
+		if (strncmp(directory[i].name, name, sizeof(directory[i].name)) == 0) return i;
+	}
+	return -1;
+}
+
+// Decompress an asset from flash into emu_ram, starting at word address addr. An odd size leaves the high byte of the last word unchanged.
+// Runs from the XIP cache, so it is best called on core1 (e.g. through the doorbell) while the emulator keeps serving the user design.
+// Returns the number of words written, or -1 if there is no such asset, it doesn't fit, or it is corrupt
+// (in which case the destination range may have been partly written).
+int ram_emu_load_asset(int index, int addr) {
+	int num_assets;
+	const asset_entry_t *directory = asset_directory(&num_assets);
+	if (index < 0 || index >= num_assets) return -1;
+	const asset_entry_t *entry = &directory[index];
+
+	if (addr < 0 || 2*addr + entry->size > sizeof(emu_ram)) return -1;
+	const uint8_t *src = (const uint8_t *)__ram_emu_assets_start__ + entry->offset;
+	if (entry->offset + entry->packed_size > (uint32_t)((const uint8_t *)__ram_emu_assets_end__ - (const uint8_t *)__ram_emu_assets_start__)) return -1;
+	uint8_t *dst = (uint8_t *)(emu_ram + addr);
+
+	int size;
+	switch (entry->method) {
+		case RAM_EMU_ASSET_STORED:
+			if (entry->packed_size != entry->size) return -1;
+			memcpy(dst, src, entry->size);
+			size = entry->size;
+			break;
+		case RAM_EMU_ASSET_RLE: size = rle_decompress(src, entry->packed_size, dst, entry->size); break;
+		case RAM_EMU_ASSET_LZ4: size = lz4_decompress(src, entry->packed_size, dst, entry->size); break;
+		default: return -1;
+	}
+	if (size != (int)entry->size) return -1;
+	return (size + 1) >> 1;
+}
+
+void ram_emu_doorbell_load_asset(volatile uint16_t *mailbox) {
+	int words = ram_emu_load_asset(mailbox[1], mailbox[2]);
+	mailbox[3] = words >= 0 ? words : 0xffff;
+}
+
+
+// Frame clock
+// ===========
+PSM frame_clock_psm;
+
+static ram_emu_frame_job_t frame_jobs[RAM_EMU_NUM_FRAME_JOBS];
+static uint32_t frame_clock_loop_count, vblank_us;
+static volatile uint32_t frame_start_us;
+
+// Page flip requested by ram_emu_set_base_at_vblank
+static uint16_t *volatile pending_read_base, *volatile pending_write_base;
+static volatile bool base_swap_pending = false;
+
+volatile uint32_t ram_emu_frame_count = 0;
+volatile int ram_emu_frame_jobs_max_us = -1;
+volatile uint32_t ram_emu_frame_jobs_overruns = 0;
+
+void ram_emu_set_frame_job(int index, ram_emu_frame_job_t job) {
+	frame_jobs[index & (RAM_EMU_NUM_FRAME_JOBS - 1)] = job;
+}
+
+static void __not_in_flash_func(frame_irq_handler)() {
+	if (!pio_interrupt_get(frame_clock_psm.pio, fpga_frame_clock_NEW_FRAME_PIO_IRQ)) return; // shared handler
+	uint32_t start = time_us_32();
+	pio_interrupt_clear(frame_clock_psm.pio, fpga_frame_clock_NEW_FRAME_PIO_IRQ);
+	frame_start_us = start;
+	uint32_t frame = ram_emu_frame_count;
+	ram_emu_frame_count = frame + 1;
+
+	// Stays pending until the address SMs have room for it
+	if (base_swap_pending && ram_emu_set_base(pending_read_base, pending_write_base)) base_swap_pending = false;
+
+	for (int i = 0; i < RAM_EMU_NUM_FRAME_JOBS; i++) {
+		if (frame_jobs[i] != NULL) frame_jobs[i](frame);
+	}
+
+	int us = time_us_32() - start;
+	if (us > ram_emu_frame_jobs_max_us) ram_emu_frame_jobs_max_us = us;
+	if (us > (int)vblank_us) ram_emu_frame_jobs_overruns++;
+}
+
+// Generate the FPGA clock with fpga_frame_clock in pio1 instead of the PWM, together with a one FPGA cycle sync pulse on sync_pin
+// every fpga_cycles_per_frame FPGA cycles. The first vblank_fpga_cycles FPGA cycles after each sync pulse are taken to be
+// vertical blanking: the user design should start its blanking interval at the sync pulse, and make no bulk accesses then.
+// The clock is held low until ram_emu_start_frame_clock, call this before ram_emu_init_flags (and before starting the FPGA).
+// The frame jobs run in an interrupt on the calling core, from the sync pulse on.
+// Returns false if the program doesn't fit in pio1 or fpga_cycles_per_frame is too small.
+bool ram_emu_init_frame_clock(int sync_pin, int fpga_cycles_per_frame, int vblank_fpga_cycles) {
+	if (fpga_cycles_per_frame < fpga_frame_clock_NONLOOP_CYCLES) return false;
+
+	PSM *psm = &frame_clock_psm;
+	if (!add_psm(psm, pio1, &fpga_frame_clock_program)) return false;
+	fpga_frame_clock_program_init(psm->pio, psm->sm, psm->offset, FPGA_CLOCK_PIN, sync_pin);
+
+	frame_clock_loop_count = fpga_cycles_per_frame - fpga_frame_clock_NONLOOP_CYCLES;
+	vblank_us = (uint64_t)vblank_fpga_cycles * 2 * 1000000 / clock_get_hz(clk_sys); // FPGA clock is half of sysclk
+
+	irq_add_shared_handler(PIO1_IRQ_0, frame_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY); // shared with RAM_EMU_FLAG_FIXED_LATENCY
+	pio_set_irq0_source_enabled(psm->pio, pis_interrupt0 + fpga_frame_clock_NEW_FRAME_PIO_IRQ, true);
+	irq_set_enabled(PIO1_IRQ_0, true);
+	return true;
+}
+
+// Start the FPGA clock, the first sync pulse comes right away
+void ram_emu_start_frame_clock() {
+	pio_sm_put(frame_clock_psm.pio, frame_clock_psm.sm, frame_clock_loop_count);
+}
+
+// Microseconds left of the current vertical blanking interval, 0 during active scanout (or if the frame clock isn't running).
+// Lets the main loop do bulk work such as USB uploads in chunks that fit in the blanking interval.
+int ram_emu_vblank_us_left() {
+	if (ram_emu_frame_count == 0) return 0;
+	uint32_t elapsed = time_us_32() - frame_start_us;
+	return elapsed < vblank_us ? vblank_us - elapsed : 0;
+}
+
+// Like ram_emu_set_base, but takes effect at the start of the next vertical blanking interval, so that a page flip doesn't tear.
+// A later call before then replaces the pending flip.
+// Returns false (and changes nothing) if a buffer is misaligned or the address SMs can't take a new base.
+bool ram_emu_set_base_at_vblank(uint16_t *read_base, uint16_t *write_base) {
+	if (ram_emu_flags & RAM_EMU_FLAG_SINGLE_PIO) return false;
+	if ((((int)read_base) | ((int)write_base)) & ((1 << 17) - 1)) return false;
+
+	base_swap_pending = false;
+	__dmb();
+	pending_read_base = read_base;
+	pending_write_base = write_base;
+	__dmb(); // bases before the flag, can be called from the other core
+	base_swap_pending = true;
+	return true;
+}
+
+
+// Number of data cycles of the longest RX message with these flags (checked from shortest to longest)
+static int rx_max_data_cycles(uint flags) {
+	int cycles = SBIO2_RX_LOOP_COUNT;
+	if (flags & RAM_EMU_FLAG_BURST_ADDR) cycles = SBIO2_RX_LOOP_COUNT + SBIO2_RX_BURST_COUNT_CYCLES;
+	if (flags & RAM_EMU_FLAG_BYTE_WRITES) cycles = 1 + SBIO2_RX_LOOP_COUNT + SBIO2_RX_BYTE_DATA_CYCLES;
+	if (flags & RAM_EMU_FLAG_LONG_WORDS) cycles = SBIO2_RX_LONG_LOOP_COUNT;
+	return cycles;
+}
+
+// RX message headers, named as in docs/pio-ram-emulator.md. Header 11 on a pin means that the message is on the other pin.
+enum { RX_HEADER_00, RX_HEADER_01, RX_HEADER_10, RX_HEADER_11, NUM_RX_HEADERS };
+#define RX_HEADER_BIT(header) (1u << RX_HEADER_##header)
+
+// Jmp pins of the SMs that run an RX program, as a bit mask
+enum { RX0 = 1, RX1 = 2 };
+
+// Data cycles of the longest RX message with each header on each RX pin, for the flags given to ram_emu_init_flags
+static int rx_header_cycles[SBIO2_NUM_PINS][NUM_RX_HEADERS];
+
+static void add_rx_message(int header0, int header1, int data_cycles) {
+	if (rx_header_cycles[0][header0] < data_cycles) rx_header_cycles[0][header0] = data_cycles;
+	if (rx_header_cycles[1][header1] < data_cycles) rx_header_cycles[1][header1] = data_cycles;
+}
+
+// Combined messages (such as send write data with a continue read on rx[1]) have the headers of their parts, so they are covered too.
+static void init_rx_messages(uint flags) {
+	// With RAM_EMU_FLAG_BURST_ADDR, header 00 is free (no count messages): the pin without a message of its own sends 00,
+	// except in address messages, so that the SMs on that pin can tell the longer address messages from the others.
+	bool burst_addr = flags & RAM_EMU_FLAG_BURST_ADDR;
+	int other = burst_addr ? RX_HEADER_00 : RX_HEADER_11;
+	int addr_cycles = burst_addr ? SBIO2_RX_LOOP_COUNT + SBIO2_RX_BURST_COUNT_CYCLES : SBIO2_RX_LOOP_COUNT;
+
+	memset(rx_header_cycles, 0, sizeof(rx_header_cycles));
+	if (!burst_addr) {
+		add_rx_message(RX_HEADER_00, RX_HEADER_11, SBIO2_RX_LOOP_COUNT); // send write count
+		add_rx_message(RX_HEADER_11, RX_HEADER_00, SBIO2_RX_LOOP_COUNT); // send read count
+	}
+	add_rx_message(RX_HEADER_01, RX_HEADER_11, addr_cycles); // send write address
+	add_rx_message(RX_HEADER_11, RX_HEADER_01, addr_cycles); // send read address
+	add_rx_message(RX_HEADER_10, other, (flags & RAM_EMU_FLAG_LONG_WORDS) ? SBIO2_RX_LONG_LOOP_COUNT : SBIO2_RX_LOOP_COUNT); // send write data
+	if (flags & RAM_EMU_FLAG_BYTE_WRITES) add_rx_message(RX_HEADER_11, RX_HEADER_10, 1 + SBIO2_RX_LOOP_COUNT + SBIO2_RX_BYTE_DATA_CYCLES);
+	if (flags & (RAM_EMU_FLAG_DOORBELL | RAM_EMU_FLAG_CONTINUE_READS)) add_rx_message(other, RX_HEADER_10, SBIO2_RX_LOOP_COUNT);
+}
+
+// Data cycles of the longest message that an SM with its jmp pin on the RX pins in pins has to skip through a path for headers
+static int rx_skip_cycles(uint pins, uint headers) {
+	int cycles = SBIO2_RX_LOOP_COUNT;
+	for (int pin = 0; pin < SBIO2_NUM_PINS; pin++) {
+		if (!(pins & (1u << pin))) continue;
+		for (int header = 0; header < NUM_RX_HEADERS; header++) {
+			if ((headers & (1u << header)) && rx_header_cycles[pin][header] > cycles) cycles = rx_header_cycles[pin][header];
+		}
+	}
+	return cycles;
+}
+
+// Skip paths and sampling delay of an RX program (see "Skip lengths" and "Sampling delay" in serial-ram-emu.pio)
+typedef struct {
+	const pio_program_t *program;
+	uint skip1, skip2, target, sample, tail; // instruction offsets
+	int delay_offset1, delay_offset2;
+	uint headers1, headers2; // headers on the jmp pin that take each skip path, RX_HEADER_BIT masks
+} rx_skips_t;
+
+#define RX_SKIPS(program, target, headers1, headers2) \
+	{&program##_program, program##_offset_skip1, program##_offset_skip2, program##_offset_##target, program##_offset_sample, program##_offset_tail, \
+	 program##_SKIP1_DELAY_OFFSET, program##_SKIP_DELAY_OFFSET, headers1, headers2}
+
+// Header checks: rx_00 and the 10 programs branch off on the first header bit, the address programs go on with it
+static const rx_skips_t rx_00_skips = RX_SKIPS(sbio2_rx_00, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(10));
+static const rx_skips_t rx_10_skips = RX_SKIPS(sbio2_rx_10, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_packed_10_skips = RX_SKIPS(sbio2_rx_packed_10, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_b2b_10_skips = RX_SKIPS(sbio2_rx_b2b_10, wait_start_bit, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_packed_b2b_10_skips = RX_SKIPS(sbio2_rx_packed_b2b_10, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_long_10_skips = RX_SKIPS(sbio2_rx_long_10, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_byte_10_skips = RX_SKIPS(sbio2_rx_byte_10, restart, RX_HEADER_BIT(01) | RX_HEADER_BIT(11), RX_HEADER_BIT(00));
+static const rx_skips_t rx_addr_01_skips = RX_SKIPS(sbio2_rx_addr_01, idle, RX_HEADER_BIT(00) | RX_HEADER_BIT(10), RX_HEADER_BIT(11));
+static const rx_skips_t rx_burst_addr_01_skips = RX_SKIPS(sbio2_rx_burst_addr_01, idle, RX_HEADER_BIT(00) | RX_HEADER_BIT(10), RX_HEADER_BIT(11));
+static const rx_skips_t rx_burst_addr_b2b_01_skips = RX_SKIPS(sbio2_rx_burst_addr_b2b_01, wait_start_bit, RX_HEADER_BIT(00) | RX_HEADER_BIT(10), RX_HEADER_BIT(11));
+static const rx_skips_t rx_compact_addr_01_skips = RX_SKIPS(sbio2_rx_compact_addr_01, restart, RX_HEADER_BIT(00) | RX_HEADER_BIT(10), RX_HEADER_BIT(11));
+
+// Reload an instruction of a program with its delay changed by delta, relocating jumps like pio_add_program does
+static void patch_delay(const PSM *psm, const pio_program_t *program, uint index, int delta) {
+	uint16_t instr = program->instructions[index];
+	if (_pio_major_instr_bits(instr) == pio_instr_bits_jmp) instr += psm->offset;
+	uint delay = ((instr >> 8) & 0x1f) + delta;
+	psm->pio->instr_mem[psm->offset + index] = (instr & ~pio_encode_delay(0x1f)) | pio_encode_delay(delay);
+}
+
+// Make the skip paths of an RX program as long as the messages they skip, for all the SMs that run it (their jmp pins are in pins),
+// by patching the delays of its skip1 and skip2 instructions, and move its data samples for the RX phase.
+static void set_rx_skip(const PSM *psm, const rx_skips_t *skips, uint pins) {
+	int cycles1 = rx_skip_cycles(pins, skips->headers1);
+	int cycles2 = rx_skip_cycles(pins, skips->headers2);
+	int early = (ram_emu_rx_phase & 4) ? 1 : 0; // the skip2 path loses the cycle taken off sample
+	// Without the idle cycle, a skip that is too long for the delay field can't come back early (check_flags keeps the skips short enough)
+	bool back_to_back = ram_emu_flags & RAM_EMU_FLAG_BACK_TO_BACK;
+
+	int delay1 = 2*cycles1 + skips->delay_offset1;
+	if (delay1 > 31 && !back_to_back) delay1 -= 2; // too long for the delay field: back one FPGA cycle earlier, when the first poll sees the idle cycle
+	bool through_skip2 = delay1 > 31; // still too long: skip1 goes on through skip2, which takes the longer skip
+	if (through_skip2 && cycles1 > cycles2) cycles2 = cycles1;
+
+	int delay2 = 2*cycles2 + skips->delay_offset2 + early;
+	if (delay2 > 31 && !back_to_back) delay2 -= 2;
+
+	volatile uint32_t *instr_mem = psm->pio->instr_mem + psm->offset;
+	instr_mem[skips->skip2] = pio_encode_jmp(psm->offset + skips->target) | pio_encode_delay(delay2);
+	if (through_skip2) instr_mem[skips->skip1] = pio_encode_jmp(psm->offset + skips->skip2) | pio_encode_delay(skips->delay_offset1 - skips->delay_offset2 - 1 - early);
+	else instr_mem[skips->skip1] = pio_encode_jmp(psm->offset + skips->target) | pio_encode_delay(delay1);
+
+	patch_delay(psm, skips->program, skips->sample, -early);
+	patch_delay(psm, skips->program, skips->tail, early);
+}
+
+// Programs shared between SMs are patched once, for the longer skips of the SMs that run them.
+// Also called by ram_emu_set_rx_phase, for the sampling delay.
+static void set_rx_skips() {
+	bool back_to_back = ram_emu_flags & RAM_EMU_FLAG_BACK_TO_BACK;
+	if (ram_emu_flags & RAM_EMU_FLAG_LONG_WORDS) set_rx_skip(&rx_wdata_psm, &rx_long_10_skips, RX0);
+	else if (ram_emu_flags & RAM_EMU_FLAG_PACKED_WRITES) set_rx_skip(&rx_wdata_psm, back_to_back ? &rx_packed_b2b_10_skips : &rx_packed_10_skips, RX0);
+	else set_rx_skip(&rx_wdata_psm, back_to_back ? &rx_b2b_10_skips : &rx_10_skips, RX0);
+
+	if (ram_emu_flags & RAM_EMU_FLAG_SINGLE_PIO) set_rx_skip(&rx_waddr_psm, &rx_compact_addr_01_skips, RX0 | RX1);
+	else if (ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR) set_rx_skip(&rx_waddr_psm, back_to_back ? &rx_burst_addr_b2b_01_skips : &rx_burst_addr_01_skips, RX0 | RX1);
+	else {
+		set_rx_skip(&rx_wcount_psm, &rx_00_skips, RX0 | RX1);
+		set_rx_skip(&rx_waddr_psm, &rx_addr_01_skips, RX0 | RX1);
+	}
+
+	if (ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES) set_rx_skip(&rx_bwrite_psm, &rx_byte_10_skips, RX1);
+	if (ram_emu_flags & RAM_EMU_FLAG_DOORBELL) set_rx_skip(&rx_doorbell_psm, &rx_10_skips, RX1);
+	if (ram_emu_flags & RAM_EMU_FLAG_CONTINUE_READS) set_rx_skip(&rx_continue_psm, &rx_10_skips, RX1);
+
+	// sbio2_tx_fixed watches rx[1] too, and skips everything but read addresses in one path, with a loop count instead of a delay
+	if (ram_emu_flags & RAM_EMU_FLAG_FIXED_LATENCY) {
+		int cycles = rx_skip_cycles(RX1, RX_HEADER_BIT(00) | RX_HEADER_BIT(10) | RX_HEADER_BIT(11));
+		tx_rdata_psm.pio->instr_mem[tx_rdata_psm.offset + sbio2_tx_fixed_offset_skip2] = pio_encode_set(pio_y, cycles + sbio2_tx_fixed_SKIP_COUNT_OFFSET);
+	}
+}
+
+// Change the FPGA clock polarity that an RX SM synchronizes to, and restart it at the synchronization point.
+// X, Y, OSR and the TX FIFO are kept, so the address SMs don't lose their buffer address or top address bits queued by ram_emu_set_base,
+// and sbio2_tx_fixed doesn't lose queued read data. Only the RX FIFO is emptied.
+static void resync_rx_psm(const PSM *psm, uint sync_offset, bool polarity) {
+	pio_sm_set_enabled(psm->pio, psm->sm, false);
+	psm->pio->instr_mem[psm->offset + sync_offset] = pio_encode_wait_gpio(polarity, FPGA_CLOCK_PIN);
+	while (!pio_sm_is_rx_fifo_empty(psm->pio, psm->sm)) pio_sm_get(psm->pio, psm->sm); // pio_sm_clear_fifos would clear the TX FIFO too
+	pio_sm_restart(psm->pio, psm->sm);
+	pio_sm_exec(psm->pio, psm->sm, pio_encode_jmp(psm->offset + sync_offset));
+	pio_sm_set_enabled(psm->pio, psm->sm, true);
+}
+
+static uint wdata_sync_offset() {
+	bool back_to_back = ram_emu_flags & RAM_EMU_FLAG_BACK_TO_BACK;
+	if (ram_emu_flags & RAM_EMU_FLAG_LONG_WORDS) return sbio2_rx_long_10_offset_clock_sync;
+	if (ram_emu_flags & RAM_EMU_FLAG_PACKED_WRITES) return back_to_back ? sbio2_rx_packed_b2b_10_offset_clock_sync : sbio2_rx_packed_10_offset_clock_sync;
+	return back_to_back ? sbio2_rx_b2b_10_offset_clock_sync : sbio2_rx_10_offset_clock_sync;
+}
+
+static uint addr_sync_offset() {
+	if (ram_emu_flags & RAM_EMU_FLAG_SINGLE_PIO) return sbio2_rx_compact_addr_01_offset_clock_sync;
+	if (ram_emu_flags & RAM_EMU_FLAG_BACK_TO_BACK) return sbio2_rx_burst_addr_b2b_01_offset_clock_sync;
+	if (ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR) return sbio2_rx_burst_addr_01_offset_clock_sync;
+	return sbio2_rx_addr_01_offset_clock_sync;
+}
+
+// Should only be called while the RX DMA channels are stopped; any partially received messages are lost.
+void ram_emu_set_rx_phase(int phase) {
+	ram_emu_rx_phase = phase;
+
+	bool polarity = phase & 1;
+	for (int i = 0; i < SBIO2_NUM_PINS; i++) gpio_set_input_hysteresis_enabled(ram_emu_rx_pin_base + i, !(phase & 2));
+	set_rx_skips(); // sampling delay, the SMs can take a wrong path while they are patched but are restarted below
+
+	// Each SM is stopped and restarted at its patched clock_sync. Programs shared between SMs (sbio2_rx_00, the address programs,
+	// sbio2_rx_10 with doorbells or continue reads) get patched once per SM, with the same instruction each time.
+	resync_rx_psm(&rx_wdata_psm, wdata_sync_offset(), polarity);
+	if (!(ram_emu_flags & RAM_EMU_FLAG_BURST_ADDR)) {
+		resync_rx_psm(&rx_wcount_psm, sbio2_rx_00_offset_clock_sync, polarity);
+		resync_rx_psm(&rx_rcount_psm, sbio2_rx_00_offset_clock_sync, polarity);
+	}
+	resync_rx_psm(&rx_waddr_psm, addr_sync_offset(), polarity);
+	resync_rx_psm(&rx_raddr_psm, addr_sync_offset(), polarity);
+	if (ram_emu_flags & RAM_EMU_FLAG_BYTE_WRITES) resync_rx_psm(&rx_bwrite_psm, sbio2_rx_byte_10_offset_clock_sync, polarity);
+	if (ram_emu_flags & RAM_EMU_FLAG_DOORBELL) resync_rx_psm(&rx_doorbell_psm, sbio2_rx_10_offset_clock_sync, polarity);
+	if (ram_emu_flags & RAM_EMU_FLAG_CONTINUE_READS) resync_rx_psm(&rx_continue_psm, sbio2_rx_10_offset_clock_sync, polarity);
+	if (ram_emu_flags & RAM_EMU_FLAG_FIXED_LATENCY) {
+		// Watches rx[1]. The late path synchronizes to the same clock level, and the on-time path waits a cycle more with polarity 0
+		// to keep the latency (see NONLOOP_CYCLES in serial-ram-emu.pio)
+		volatile uint32_t *instr_mem = tx_rdata_psm.pio->instr_mem + tx_rdata_psm.offset;
+		instr_mem[sbio2_tx_fixed_offset_late_sync] = pio_encode_wait_gpio(polarity, FPGA_CLOCK_PIN);
+		instr_mem[sbio2_tx_fixed_offset_on_time] = pio_encode_pull(false, false) | pio_encode_delay(sbio2_tx_fixed_ON_TIME_DELAY + !polarity);
+		resync_rx_psm(&tx_rdata_psm, sbio2_tx_fixed_offset_clock_sync, polarity);
+	}
+}
+
+// RX phases of one clock polarity, from the one that samples the data bits earliest to the latest: one PIO cycle early before
+// on time, and with input hysteresis (which delays the inputs a little) before without.
+enum { RX_PHASES_PER_POLARITY = RAM_EMU_NUM_RX_PHASES/2 };
+static const int rx_phase_order[RX_PHASES_PER_POLARITY] = {4, 4 | 2, 0, 2};
+
+// Count the number of training words received correctly, out of num_words. Returns -1 on any error.
+static int count_training_words(int num_words, int timeout_us) {
+	PIO pio = rx_wdata_psm.pio;
+	uint sm = rx_wdata_psm.sm;
+
+	// Two words per FIFO entry with RAM_EMU_FLAG_PACKED_WRITES
+	bool packed = (ram_emu_flags & (RAM_EMU_FLAG_PACKED_WRITES | RAM_EMU_FLAG_LONG_WORDS)) == RAM_EMU_FLAG_PACKED_WRITES;
+	int words_per_entry = packed ? 2 : 1;
+
+	absolute_time_t timeout = make_timeout_time_us(timeout_us);
+	int num_good = 0;
+	for (int i = 0; i < num_words; i += words_per_entry) {
+		while (pio_sm_is_rx_fifo_empty(pio, sm) && !time_reached(timeout)) tight_loop_contents();
+		if (pio_sm_is_rx_fifo_empty(pio, sm)) break;
+
+		uint32_t entry = pio_sm_get(pio, sm);
+		for (int j = 0; j < words_per_entry; j++) {
+			uint16_t data = entry >> (16*j);
+			if (data != RAM_EMU_TRAINING_WORD0 && data != RAM_EMU_TRAINING_WORD1) return -1;
+			num_good++;
+		}
+	}
+	return num_good;
+}
+
+// Find the RX sampling phase with the widest margin, using a known pattern from the user design.
+// Call after releasing reset, before starting the DMA. The user design should send send write data messages
+// with RAM_EMU_TRAINING_WORD0/1 until it receives a TX message, which contains the selected phase.
+// It should then stop within 64 cycles, and wait at least 1024 cycles before sending anything else.
+// For each clock polarity, the candidates are put in the order in which they sample the data bits (see rx_phase_order),
+// and the centre of the longest run of passing candidates is taken, which samples furthest away from the data transitions.
+// Returns the selected phase, or -1 if no phase passed (the default phase is kept then).
+int ram_emu_train_rx_phase(int words_per_candidate, int timeout_us) {
+	bool passed[RAM_EMU_NUM_RX_PHASES];
+	for (int phase = 0; phase < RAM_EMU_NUM_RX_PHASES; phase++) {
+		ram_emu_set_rx_phase(phase);
+		count_training_words(2, timeout_us); // skip words that might have been cut by the restart
+		passed[phase] = count_training_words(words_per_candidate, timeout_us) == words_per_candidate;
+	}
+
+	int best_phase = -1, best_run = 0;
+	for (int polarity = 0; polarity < 2; polarity++) {
+		int run = 0;
+		for (int i = 0; i <= RX_PHASES_PER_POLARITY; i++) {
+			if (i < RX_PHASES_PER_POLARITY && passed[polarity | rx_phase_order[i]]) {
+				run++;
+				continue;
+			}
+			if (run > 0) {
+				// Centre of the run that ended at i-1; of the two centres of an even run, prefer the default phase
+				int phase = polarity | rx_phase_order[i - 1 - run/2];
+				if (run % 2 == 0 && (polarity | rx_phase_order[i - run/2]) == RAM_EMU_RX_PHASE_DEFAULT) phase = RAM_EMU_RX_PHASE_DEFAULT;
+				// Prefer the default phase on ties
+				if (run > best_run || (run == best_run && phase == RAM_EMU_RX_PHASE_DEFAULT)) {
+					best_phase = phase;
+					best_run = run;
+				}
+			}
+			run = 0;
+		}
+	}
+
+	ram_emu_set_rx_phase(best_phase >= 0 ? best_phase : RAM_EMU_RX_PHASE_DEFAULT);
+
+	// Tell the user design that training is done, wait for it to stop, and flush the training data
+	pio_sm_put(tx_rdata_psm.pio, tx_rdata_psm.sm, best_phase & 0xffff);
+	if (ram_emu_flags & RAM_EMU_FLAG_FIXED_LATENCY) pio_sm_exec(tx_rdata_psm.pio, tx_rdata_psm.sm, pio_encode_jmp(tx_rdata_psm.offset + sbio2_tx_fixed_offset_send)); // not a read response
+	busy_wait_at_least_cycles(2*256);
+	// Restart to also drop a half received pair with RAM_EMU_FLAG_PACKED_WRITES
+	resync_rx_psm(&rx_wdata_psm, wdata_sync_offset(), ram_emu_rx_phase & 1);
+
+	return best_phase;
+}
+
+
+const char *ram_emu_init_error = NULL;
+
+// SMs and instructions that ram_emu_init_flags loads into each PIO block, see PIO resources in docs/pio-ram-emulator.md
+typedef struct {
+	int sms, instructions;
+} pio_usage_t;
+
+static void add_pio_usage(pio_usage_t *usage, int sms, const pio_program_t *program) {
+	usage->sms += sms;
+	if (program != NULL) usage->instructions += program->length;
+}
+
+// Must follow what ram_emu_init_flags loads where
+static void get_pio_usage(uint flags, pio_usage_t usage[2]) {
+	if (flags & RAM_EMU_FLAG_LONG_WORDS) add_pio_usage(&usage[0], 1, &sbio2_tx_long_program);
+	else if (flags & RAM_EMU_FLAG_FIXED_LATENCY) add_pio_usage(&usage[1], 1, &sbio2_tx_fixed_program);
+	else if (flags & RAM_EMU_FLAG_TX_BURST) add_pio_usage(&usage[0], 1, &sbio2_tx_burst_program);
+	else add_pio_usage(&usage[0], 1, &sbio2_tx_program); // same length as sbio2_tx_fast
+
+	if (!(flags & RAM_EMU_FLAG_BACK_TO_BACK)) add_pio_usage(&usage[0], 1, &sbio2_rx_10_program); // same length as the packed and long versions
+	else if (flags & RAM_EMU_FLAG_PACKED_WRITES) add_pio_usage(&usage[0], 1, &sbio2_rx_packed_b2b_10_program);
+	else add_pio_usage(&usage[0], 1, &sbio2_rx_b2b_10_program);
+
+	if (flags & RAM_EMU_FLAG_SINGLE_PIO) add_pio_usage(&usage[0], 2, &sbio2_rx_compact_addr_01_program);
+	else {
+		if (!(flags & RAM_EMU_FLAG_BURST_ADDR)) add_pio_usage(&usage[0], 2, &sbio2_rx_00_program);
+		if (flags & RAM_EMU_FLAG_BACK_TO_BACK) add_pio_usage(&usage[1], 2, &sbio2_rx_burst_addr_b2b_01_program);
+		else add_pio_usage(&usage[1], 2, (flags & RAM_EMU_FLAG_BURST_ADDR) ? &sbio2_rx_burst_addr_01_program : &sbio2_rx_addr_01_program);
+	}
+
+	if (flags & RAM_EMU_FLAG_BYTE_WRITES) add_pio_usage(&usage[1], 1, &sbio2_rx_byte_10_program);
+	if (flags & RAM_EMU_FLAG_DOORBELL) add_pio_usage(&usage[1], 1, &sbio2_rx_10_program);
+	if (flags & RAM_EMU_FLAG_CONTINUE_READS) add_pio_usage(&usage[1], 1, &sbio2_rx_10_program); // pio_add_program doesn't share it
+	if (flags & RAM_EMU_FLAG_QUEUED_READS) add_pio_usage(&usage[1], 1, &fifo_forward_program);
+	if (flags & RAM_EMU_FLAG_QUEUED_WRITES) add_pio_usage(&usage[1], 1, (flags & RAM_EMU_FLAG_QUEUED_READS) ? NULL : &fifo_forward_program);
+}
+
+// Check the flags before anything is loaded. Returns NULL if they are fine, or what is wrong with them.
+static const char *check_flags(uint flags) {
+	if ((flags & RAM_EMU_FLAG_FIXED_LATENCY) && (flags & RAM_EMU_FLAG_LONG_WORDS)) return "RAM_EMU_FLAG_FIXED_LATENCY can't be combined with RAM_EMU_FLAG_LONG_WORDS";
+	// sbio2_tx_fixed sends one word per read address message
+	if ((flags & RAM_EMU_FLAG_FIXED_LATENCY) && (flags & (RAM_EMU_FLAG_QUEUED_READS | RAM_EMU_FLAG_CONTINUE_READS))) {
+		return "RAM_EMU_FLAG_FIXED_LATENCY can't be combined with RAM_EMU_FLAG_QUEUED_READS or RAM_EMU_FLAG_CONTINUE_READS";
+	}
+	if ((flags & RAM_EMU_FLAG_DOORBELL) && (flags & RAM_EMU_FLAG_BYTE_WRITES)) return "RAM_EMU_FLAG_DOORBELL can't be combined with RAM_EMU_FLAG_BYTE_WRITES";
+	// The TX rdata ctrl channel would load the next queue entry over a resumed burst
+	if ((flags & RAM_EMU_FLAG_CONTINUE_READS) && (flags & (RAM_EMU_FLAG_BYTE_WRITES | RAM_EMU_FLAG_DOORBELL | RAM_EMU_FLAG_QUEUED_READS))) {
+		return "RAM_EMU_FLAG_CONTINUE_READS can't be combined with RAM_EMU_FLAG_BYTE_WRITES, RAM_EMU_FLAG_DOORBELL or RAM_EMU_FLAG_QUEUED_READS";
+	}
+	// Only the write data and burst address programs have back-to-back versions, and 32 bit words need skips too long for the delay field
+	if ((flags & RAM_EMU_FLAG_BACK_TO_BACK) && !(flags & RAM_EMU_FLAG_BURST_ADDR)) return "RAM_EMU_FLAG_BACK_TO_BACK needs RAM_EMU_FLAG_BURST_ADDR";
+	if ((flags & RAM_EMU_FLAG_BACK_TO_BACK) && (flags & (RAM_EMU_FLAG_SINGLE_PIO | RAM_EMU_FLAG_LONG_WORDS | RAM_EMU_FLAG_BYTE_WRITES | RAM_EMU_FLAG_DOORBELL | RAM_EMU_FLAG_CONTINUE_READS | RAM_EMU_FLAG_FIXED_LATENCY))) {
+		return "RAM_EMU_FLAG_BACK_TO_BACK can't be combined with RAM_EMU_FLAG_SINGLE_PIO, RAM_EMU_FLAG_LONG_WORDS, RAM_EMU_FLAG_BYTE_WRITES, RAM_EMU_FLAG_DOORBELL, RAM_EMU_FLAG_CONTINUE_READS or RAM_EMU_FLAG_FIXED_LATENCY";
+	}
+
+	pio_usage_t usage[2] = {{0, 0}, {0, 0}};
+	get_pio_usage(flags, usage);
+	static const char *const sm_errors[2] = {"the flags need more SMs than are free in pio0", "the flags need more SMs than are free in pio1"};
+	static const char *const instruction_errors[2] = {"the flags need more instruction memory than is free in pio0", "the flags need more instruction memory than is free in pio1"};
+	for (int i = 0; i < 2; i++) {
+		PIO pio = i ? pio1 : pio0;
+		int free_sms = 0;
+		for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) if (!pio_sm_is_claimed(pio, sm)) free_sms++;
+		// The frame clock is the only other program that the emulator loads before ram_emu_init_flags
+		int free_instructions = PIO_INSTRUCTION_COUNT - (pio == frame_clock_psm.pio ? fpga_frame_clock_program.length : 0);
+		if (usage[i].sms > free_sms) return sm_errors[i];
+		if (usage[i].instructions > free_instructions) return instruction_errors[i];
+	}
+	return NULL;
+}
 
 bool ram_emu_init(int rx_pin_base, int tx_pin_base, bool start_dma) {
+	return ram_emu_init_flags(rx_pin_base, tx_pin_base, start_dma, 0);
+}
+
+bool ram_emu_init_flags(int rx_pin_base, int tx_pin_base, bool start_dma, uint flags) {
+	if (flags & RAM_EMU_FLAG_SINGLE_PIO) flags |= RAM_EMU_FLAG_BURST_ADDR;
+	ram_emu_init_error = check_flags(flags);
+	if (ram_emu_init_error != NULL) return false;
+	ram_emu_flags = flags;
+	ram_emu_rx_max_data_cycles = rx_max_data_cycles(flags);
+	init_rx_messages(flags);
+	ram_emu_rx_pin_base = rx_pin_base;
+	ram_emu_tx_pin_base = tx_pin_base;
+
 	// Start PIO
 	// =========
 	PIO pio = pio0;
@@ -162,36 +1363,122 @@ bool ram_emu_init(int rx_pin_base, int tx_pin_base, bool start_dma) {
 	// TX rdata
 	// --------
 	psm = &tx_rdata_psm;
-	if (add_psm(psm, pio, &sbio2_tx_program)) sbio2_tx_program_init(pio, psm->sm, psm->offset, tx_pin_base); else ok = false;
+	if (flags & RAM_EMU_FLAG_LONG_WORDS) {
+		if (add_psm(psm, pio, &sbio2_tx_long_program)) sbio2_tx_long_program_init(pio, psm->sm, psm->offset, tx_pin_base); else ok = false;
+	} else if (flags & RAM_EMU_FLAG_FIXED_LATENCY) {
+		// Doesn't fit in pio0 together with the RX wdata program and the count or address programs
+		if (add_psm(psm, pio1, &sbio2_tx_fixed_program)) {
+			sbio2_tx_fixed_program_init(pio1, psm->sm, psm->offset, tx_pin_base, rx_pin_base + 1, ram_emu_fixed_latency - sbio2_tx_fixed_NONLOOP_CYCLES);
+			init_fixed_latency_irq();
+		} else ok = false;
+	} else if (flags & RAM_EMU_FLAG_TX_BURST) {
+		if (add_psm(psm, pio, &sbio2_tx_burst_program)) sbio2_tx_burst_program_init(pio, psm->sm, psm->offset, tx_pin_base); else ok = false;
+	} else if (flags & RAM_EMU_FLAG_TX_LOW_LATENCY) {
+		if (add_psm(psm, pio, &sbio2_tx_fast_program)) sbio2_tx_fast_program_init(pio, psm->sm, psm->offset, tx_pin_base); else ok = false;
+	} else {
+		if (add_psm(psm, pio, &sbio2_tx_program)) sbio2_tx_program_init(pio, psm->sm, psm->offset, tx_pin_base); else ok = false;
+	}
 
 	// RX wdata
 	// --------
 	psm = &rx_wdata_psm;
-	if (add_psm(psm, pio, &sbio2_rx_10_program)) sbio2_rx_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	if (flags & RAM_EMU_FLAG_LONG_WORDS) {
+		if (add_psm(psm, pio, &sbio2_rx_long_10_program)) sbio2_rx_long_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	} else if ((flags & RAM_EMU_FLAG_PACKED_WRITES) && (flags & RAM_EMU_FLAG_BACK_TO_BACK)) {
+		if (add_psm(psm, pio, &sbio2_rx_packed_b2b_10_program)) sbio2_rx_packed_b2b_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	} else if (flags & RAM_EMU_FLAG_PACKED_WRITES) {
+		if (add_psm(psm, pio, &sbio2_rx_packed_10_program)) sbio2_rx_packed_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	} else if (flags & RAM_EMU_FLAG_BACK_TO_BACK) {
+		if (add_psm(psm, pio, &sbio2_rx_b2b_10_program)) sbio2_rx_b2b_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	} else {
+		if (add_psm(psm, pio, &sbio2_rx_10_program)) sbio2_rx_10_program_init(pio, psm->sm, psm->offset, rx_pin_base); else ok = false;
+	}
 
-	// RX wcount
-	// ---------
-	psm = &rx_wcount_psm;
-	if (add_psm(psm, pio, &sbio2_rx_00_program)) sbio2_rx_00_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base); else ok = false;
+	if (flags & RAM_EMU_FLAG_SINGLE_PIO) {
+		// RX waddr, raddr -- in pio0, instead of the count SMs
+		// ----------------------------------------------------
+		psm = &rx_waddr_psm;
+		if (add_psm(psm, pio, &sbio2_rx_compact_addr_01_program)) sbio2_rx_compact_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base, ((int)emu_ram)>>17); else ok = false;
+		psm = &rx_raddr_psm;
+		if (clone_psm(psm, &rx_waddr_psm)) sbio2_rx_compact_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1, ((int)emu_ram)>>17); else ok = false;
 
-	// RX rcount-- initialize after RX waddr
-	// -------------------------------------
-	psm = &rx_rcount_psm;
-	if (clone_psm(psm, &rx_wcount_psm)) sbio2_rx_00_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1); else ok = false;
+		pio = pio1; // optional SMs below
+	} else {
+		// With burst address messages, the counts only come from the address messages
+		if (!(flags & RAM_EMU_FLAG_BURST_ADDR)) {
+			// RX wcount
+			// ---------
+			psm = &rx_wcount_psm;
+			if (add_psm(psm, pio, &sbio2_rx_00_program)) sbio2_rx_00_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base); else ok = false;
 
-	pio = pio1;
+			// RX rcount-- initialize after RX waddr
+			// -------------------------------------
+			psm = &rx_rcount_psm;
+			if (clone_psm(psm, &rx_wcount_psm)) sbio2_rx_00_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1); else ok = false;
+		}
 
-	// RX waddr
-	// --------
-	psm = &rx_waddr_psm;
-	if (add_psm(psm, pio, &sbio2_rx_addr_01_program)) sbio2_rx_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base); else ok = false;
-	pio_sm_put(rx_waddr_psm.pio, rx_waddr_psm.sm, ((int)emu_ram)>>17); // Initialize aligned buffer address
-
-	// RX raddr -- initialize after RX waddr
-	// -------------------------------------
-	psm = &rx_raddr_psm;
-	if (clone_psm(psm, &rx_waddr_psm)) sbio2_rx_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1); else ok = false;
-	pio_sm_put(rx_raddr_psm.pio, rx_raddr_psm.sm, ((int)emu_ram)>>17); // Initialize aligned buffer address
+		pio = pio1;
+
+		// RX waddr
+		// --------
+		psm = &rx_waddr_psm;
+		if (flags & RAM_EMU_FLAG_BACK_TO_BACK) {
+			if (add_psm(psm, pio, &sbio2_rx_burst_addr_b2b_01_program)) sbio2_rx_burst_addr_b2b_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base, ((int)emu_ram)>>17); else ok = false;
+		} else if (flags & RAM_EMU_FLAG_BURST_ADDR) {
+			if (add_psm(psm, pio, &sbio2_rx_burst_addr_01_program)) sbio2_rx_burst_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base, ((int)emu_ram)>>17); else ok = false;
+		} else {
+			if (add_psm(psm, pio, &sbio2_rx_addr_01_program)) sbio2_rx_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base, ((int)emu_ram)>>17); else ok = false;
+		}
+
+		// RX raddr -- initialize after RX waddr
+		// -------------------------------------
+		psm = &rx_raddr_psm;
+		if (!clone_psm(psm, &rx_waddr_psm)) ok = false;
+		else if (flags & RAM_EMU_FLAG_BACK_TO_BACK) sbio2_rx_burst_addr_b2b_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1, ((int)emu_ram)>>17);
+		else if (flags & RAM_EMU_FLAG_BURST_ADDR) sbio2_rx_burst_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1, ((int)emu_ram)>>17);
+		else sbio2_rx_addr_01_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1, ((int)emu_ram)>>17);
+	}
+
+	// RX byte write
+	// -------------
+	if (flags & RAM_EMU_FLAG_BYTE_WRITES) {
+		psm = &rx_bwrite_psm;
+		if (add_psm(psm, pio, &sbio2_rx_byte_10_program)) sbio2_rx_byte_10_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1, ((int)emu_ram)>>17); else ok = false;
+	}
+
+	// RX doorbell -- uses the header code of byte writes
+	// ---------------------------------------------------
+	if (flags & RAM_EMU_FLAG_DOORBELL) {
+		psm = &rx_doorbell_psm;
+		if (add_psm(psm, pio, &sbio2_rx_10_program)) sbio2_rx_10_doorbell_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1); else ok = false;
+	}
+
+	// RX continue read -- also uses the header code of byte writes, same message format as doorbells (the data is ignored)
+	// ---------------------------------------------------------------------------------------------------------------------
+	if (flags & RAM_EMU_FLAG_CONTINUE_READS) {
+		psm = &rx_continue_psm;
+		if (add_psm(psm, pio, &sbio2_rx_10_program)) sbio2_rx_10_doorbell_program_init(pio, psm->sm, psm->offset, rx_pin_base, rx_pin_base + 1); else ok = false;
+	}
+
+	// Read queue
+	// ----------
+	if (flags & RAM_EMU_FLAG_QUEUED_READS) {
+		psm = &read_queue_psm;
+		if (add_psm(psm, pio, &fifo_forward_program)) fifo_forward_program_init(pio, psm->sm, psm->offset); else ok = false;
+	}
+
+	// Write queue -- shares the program with the read queue if there is one
+	// ---------------------------------------------------------------------
+	if (flags & RAM_EMU_FLAG_QUEUED_WRITES) {
+		psm = &write_queue_psm;
+		bool added = (flags & RAM_EMU_FLAG_QUEUED_READS) ? clone_psm(psm, &read_queue_psm) : add_psm(psm, pio, &fifo_forward_program);
+		if (added) fifo_forward_program_init(pio, psm->sm, psm->offset); else ok = false;
+	}
+
+	// RX skip lengths
+	// ---------------
+	if (ok) set_rx_skips();
+	else ram_emu_init_error = "a PIO program or SM could not be added"; // check_flags should have caught this
 
 	// Set up DMA
 	// ==========
@@ -13,15 +13,149 @@ typedef struct {
 extern uint16_t emu_ram[65536];
 static const int emu_ram_elements = 65536;
 
+#ifdef RAM_EMU_ALT_LAYOUT
+// Second buffer for page flipping with ram_emu_set_base, placed below emu_ram by sram_memmap_alt.ld
+extern uint16_t emu_ram_alt[65536];
+#endif
+
+// Buffers currently used by the read and write paths
+extern uint16_t *ram_emu_read_base, *ram_emu_write_base;
+
 extern PSM tx_rdata_psm;
 extern PSM rx_wdata_psm, rx_waddr_psm, rx_wcount_psm;
 extern PSM               rx_raddr_psm, rx_rcount_psm;
+extern PSM read_queue_psm, write_queue_psm;
+extern PSM rx_bwrite_psm;
+extern PSM rx_continue_psm;
+
+
+// Flags for ram_emu_init_flags
+enum {
+	RAM_EMU_FLAG_TX_LOW_LATENCY = 1, // Send get read data messages with SBIO2_TX_FAST_START_BITS start cycles and no header
+	RAM_EMU_FLAG_QUEUED_READS = 2,   // Queue read transactions, so that read addresses can be sent back-to-back
+	RAM_EMU_FLAG_QUEUED_WRITES = 4,  // Queue write transactions, so that the next write address can be sent before the write data
+	RAM_EMU_FLAG_BURST_ADDR = 8,     // Read/write address messages carry a 4 bit count after the address, instead of count messages (header 00 marks other messages on the free pin)
+	RAM_EMU_FLAG_BYTE_WRITES = 16,   // Accept send byte write messages (header 10 on rx[1])
+	RAM_EMU_FLAG_LONG_WORDS = 32,    // Write data and read data messages carry 32 bit words (overrides RAM_EMU_FLAG_TX_LOW_LATENCY)
+	RAM_EMU_FLAG_DOORBELL = 64,      // Accept doorbell messages (header 10 on rx[1], not together with RAM_EMU_FLAG_BYTE_WRITES)
+	RAM_EMU_FLAG_PACKED_WRITES = 128, // Move write data as pairs of words: write addresses must be even, write counts are in pairs of words
+	RAM_EMU_FLAG_TX_BURST = 256,     // Like RAM_EMU_FLAG_TX_LOW_LATENCY, but send words that are ready back-to-back without stop bits
+	RAM_EMU_FLAG_SINGLE_PIO = 512,   // Run the emulator in pio0 only, leaving pio1 free; implies RAM_EMU_FLAG_BURST_ADDR, no count messages, and ram_emu_set_base always returns false
+	RAM_EMU_FLAG_WRITE_ACKS = 1024,  // Send ram_emu_write_ack_word as a get read data message when each write transaction has finished
+	RAM_EMU_FLAG_BACK_TO_BACK = 2048, // Accept RX messages without idle cycles in between; needs RAM_EMU_FLAG_BURST_ADDR; not with RAM_EMU_FLAG_SINGLE_PIO, RAM_EMU_FLAG_LONG_WORDS, RAM_EMU_FLAG_BYTE_WRITES, RAM_EMU_FLAG_DOORBELL, RAM_EMU_FLAG_CONTINUE_READS or RAM_EMU_FLAG_FIXED_LATENCY
+	RAM_EMU_FLAG_FIXED_LATENCY = 4096, // Send each read response ram_emu_fixed_latency cycles after its read address message (single word reads, not with RAM_EMU_FLAG_LONG_WORDS, RAM_EMU_FLAG_QUEUED_READS or RAM_EMU_FLAG_CONTINUE_READS)
+	RAM_EMU_FLAG_CONTINUE_READS = 8192, // Accept continue read messages (header 10 on rx[1]), which resume the previous read burst; not with RAM_EMU_FLAG_QUEUED_READS, RAM_EMU_FLAG_BYTE_WRITES or RAM_EMU_FLAG_DOORBELL
+};
+
+extern uint ram_emu_flags;
+
+// Number of data cycles of the longest RX message for the flags given to ram_emu_init_flags.
+// 1 + ram_emu_rx_max_data_cycles - (its data cycles) idle cycles after an RX message are always enough (one less with
+// RAM_EMU_FLAG_BACK_TO_BACK), but most modes need fewer, see Message lengths in docs/pio-ram-emulator.md.
+extern int ram_emu_rx_max_data_cycles;
+
+// Sent by RAM_EMU_FLAG_WRITE_ACKS (low 16 bits unless RAM_EMU_FLAG_LONG_WORDS), can be changed at any time
+extern volatile uint32_t ram_emu_write_ack_word;
+
+// RX sampling phase
+// bit 0: FPGA clock polarity that the RX SMs synchronize to, bit 1: set to disable input hysteresis on the RX pins,
+// bit 2: set to sample the data bits one PIO cycle earlier (the headers are sampled as before)
+enum { RAM_EMU_RX_PHASE_DEFAULT = 1, RAM_EMU_NUM_RX_PHASES = 8 };
+// The user design sends send write data messages alternating between these words during RX phase training.
+// Each pin toggles every cycle in both.
+enum { RAM_EMU_TRAINING_WORD0 = 0x6666, RAM_EMU_TRAINING_WORD1 = 0x9999 };
+
+extern int ram_emu_rx_phase;
+
+// Read latency measured by ram_emu_calibrate_latency, in FPGA cycles from start bit to start bit (-1 if not measured)
+extern int ram_emu_read_latency_min, ram_emu_read_latency_max;
+
+// RAM_EMU_FLAG_FIXED_LATENCY: read latency in FPGA cycles from start bit to start bit, and the number of responses that missed it
+enum { RAM_EMU_FIXED_LATENCY_DEFAULT = 32 };
+extern int ram_emu_fixed_latency;
+extern volatile uint32_t ram_emu_fixed_latency_misses;
 
 
 bool ram_emu_init(int rx_pin_base, int tx_pin_base, bool start_dma);
+// Returns false if the flags can't be combined, or don't fit in the free PIO SMs and instruction memory (checked before anything
+// is loaded, see PIO resources in docs/pio-ram-emulator.md); ram_emu_init_error then says why.
+bool ram_emu_init_flags(int rx_pin_base, int tx_pin_base, bool start_dma, uint flags);
+extern const char *ram_emu_init_error;
 void ram_emu_configure_dma(bool enable);
 void ram_emu_stop_dma();
 
+int ram_emu_load_image();
+
+bool ram_emu_set_base(uint16_t *read_base, uint16_t *write_base);
+
+int ram_emu_calibrate_latency(int num_samples, int timeout_us, int report_addr);
+int ram_emu_calibrate_latency_loaded(int num_samples, int timeout_us, int report_addr, void (*load)(void));
+bool ram_emu_set_fixed_latency(int latency);
+
+// Doorbell
+// Command word: bits 15-12 = handler index, bits 11-0 = mailbox address in emu_ram / RAM_EMU_DOORBELL_MAILBOX_WORDS.
+// mailbox[0] is set to RAM_EMU_DOORBELL_DONE when the handler has returned (RAM_EMU_DOORBELL_NO_HANDLER if there was none),
+// the rest of the mailbox is up to the handler.
+enum { RAM_EMU_DOORBELL_NUM_HANDLERS = 16, RAM_EMU_DOORBELL_MAILBOX_WORDS = 16 };
+enum { RAM_EMU_DOORBELL_DONE = 1, RAM_EMU_DOORBELL_NO_HANDLER = 0xffff };
+typedef void (*ram_emu_doorbell_handler_t)(volatile uint16_t *mailbox);
+
+extern PSM rx_doorbell_psm;
+// Core1 cycles from entering the doorbell interrupt to calling the handler, and to setting the completion flag (-1 if none yet)
+extern volatile int ram_emu_doorbell_dispatch_cycles_max, ram_emu_doorbell_done_cycles_max;
+
+void ram_emu_set_doorbell_handler(int index, ram_emu_doorbell_handler_t handler);
+void ram_emu_doorbell_core1_main();
+
+bool ram_emu_set_ring_windows(int read_log2_words, int write_log2_words);
+// Doorbell handler: mailbox[1] = read_log2_words, mailbox[2] = write_log2_words -> mailbox[3] = 1 if ok
+void ram_emu_doorbell_set_ring_windows(volatile uint16_t *mailbox);
+
+// Checksum over emu_ram, computed by the DMA sniffer
+enum { RAM_EMU_CHECKSUM_CRC32 = 0, RAM_EMU_CHECKSUM_SUM = 1 };
+uint32_t ram_emu_checksum(int addr, int num_words, int mode);
+// Doorbell handler: mailbox[1] = start address, mailbox[2] = number of words (0 = 65536), mailbox[3] = mode
+// -> mailbox[4..5] = checksum (low word first)
+void ram_emu_doorbell_checksum(volatile uint16_t *mailbox);
+
+// Affine fetch: texels gathered by the interpolator of the calling core, sent through the TX rdata SM
+enum { RAM_EMU_AFFINE_FRAC_BITS = 16 };
+bool ram_emu_affine_fetch(int texture_addr, int log2_width, int log2_height, uint32_t u, uint32_t v, int32_t du, int32_t dv, int num_pixels);
+// Doorbell handler: mailbox[1] = texture address, mailbox[2] = log2_width | log2_height << 8, mailbox[3..4] = u, mailbox[5..6] = v,
+// mailbox[7..8] = du, mailbox[9..10] = dv (16.16 fixed point texels, low word first), mailbox[11] = number of pixels (0 = 65536)
+// -> mailbox[12] = 1 if ok
+void ram_emu_doorbell_affine_fetch(volatile uint16_t *mailbox);
+// Pixels sent, and microseconds spent sending them, since startup (wrapping)
+extern volatile uint32_t ram_emu_affine_pixels, ram_emu_affine_busy_us;
+
+// Compressed assets linked into flash (see RAM_EMU_ASSETS in CMakeLists.txt, built by host/pack-assets.py)
+enum { RAM_EMU_ASSET_STORED = 0, RAM_EMU_ASSET_RLE = 1, RAM_EMU_ASSET_LZ4 = 2 };
+int ram_emu_num_assets();
+int ram_emu_find_asset(const char *name); // -1 if not found
+int ram_emu_load_asset(int index, int addr);
+// Doorbell handler: mailbox[1] = asset index, mailbox[2] = destination address -> mailbox[3] = number of words written, 0xffff on error
+void ram_emu_doorbell_load_asset(volatile uint16_t *mailbox);
+
+// Frame clock: FPGA clock and frame sync generated by fpga_frame_clock, with jobs run at the start of each vertical blanking interval
+enum { RAM_EMU_NUM_FRAME_JOBS = 8 };
+typedef void (*ram_emu_frame_job_t)(uint32_t frame); // should return well within the blanking interval
+
+extern PSM frame_clock_psm;
+// Frames since the clock was started, longest time spent in the frame jobs (-1 if none yet),
+// and the number of frames in which they took longer than the blanking interval
+extern volatile uint32_t ram_emu_frame_count;
+extern volatile int ram_emu_frame_jobs_max_us;
+extern volatile uint32_t ram_emu_frame_jobs_overruns;
+
+bool ram_emu_init_frame_clock(int sync_pin, int fpga_cycles_per_frame, int vblank_fpga_cycles);
+void ram_emu_start_frame_clock();
+void ram_emu_set_frame_job(int index, ram_emu_frame_job_t job); // jobs run in index order, NULL to remove
+int ram_emu_vblank_us_left();
+bool ram_emu_set_base_at_vblank(uint16_t *read_base, uint16_t *write_base);
+
+void ram_emu_set_rx_phase(int phase);
+int ram_emu_train_rx_phase(int words_per_candidate, int timeout_us);
+
 
 bool add_psm(PSM *psm, PIO pio, const pio_program_t *program);
 bool clone_psm(PSM *psm, const PSM *source);